@@ -0,0 +1,139 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * small example server for libacpi, serves the OpenMetrics exposition
+ * over HTTP on a local TCP port or a unix socket
+ * usage: acpi-exporter [-p port | -u socket]
+ */
+
+#include "libacpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 9595
+
+static const char header[] = "HTTP/1.0 200 OK\r\n"
+	"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+	"Connection: close\r\n\r\n";
+static const char error[] = "HTTP/1.0 500 Internal Server Error\r\n"
+	"Content-Type: text/plain; charset=utf-8\r\n"
+	"Connection: close\r\n\r\ncould not render metrics\n";
+
+/* open a listening socket, either on localhost:port or on the unix socket path */
+static int
+listen_on(const char *path, int port){
+	struct sockaddr_in in;
+	struct sockaddr_un un;
+	int fd, on = 1;
+
+	if(path){
+		if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return -1;
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		snprintf(un.sun_path, sizeof(un.sun_path), "%s", path);
+		unlink(path);
+		if(bind(fd, (struct sockaddr *)&un, sizeof(un)) < 0)
+			goto err;
+	} else {
+		if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			return -1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_port = htons(port);
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if(bind(fd, (struct sockaddr *)&in, sizeof(in)) < 0)
+			goto err;
+	}
+	if(listen(fd, 16) < 0)
+		goto err;
+	return fd;
+err:
+	close(fd);
+	return -1;
+}
+
+/* refresh all devices */
+static void
+refresh(global_t *global){
+	int i;
+
+	read_acpi_acstate(global);
+	for(i = 0; i < global->batt_count; i++)
+		read_acpi_batt(i);
+	for(i = 0; i < global->thermal_count; i++)
+		read_acpi_zone(i, global);
+	for(i = 0; i < global->fan_count; i++)
+		read_acpi_fan(i);
+	for(i = 0; i < global->powercap_count; i++)
+		read_acpi_powercap(i);
+}
+
+int
+main(int argc, char **argv){
+	static char req[1024];
+	char *buf;
+	const char *path = NULL;
+	int port = DEFAULT_PORT;
+	int fd, c, len;
+	global_t *global = calloc(1, sizeof(global_t));
+
+	if(argc == 3 && !strcmp(argv[1], "-u"))
+		path = argv[2];
+	else if(argc == 3 && !strcmp(argv[1], "-p"))
+		port = atoi(argv[2]);
+	else if(argc != 1){
+		fprintf(stderr, "usage: %s [-p port | -u socket]\n", argv[0]);
+		return 1;
+	}
+
+	if(!global || check_acpi_support() == NOT_SUPPORTED){
+		printf("No acpi support for your system?\n");
+		return -1;
+	}
+	init_acpi_supplies(global);
+	init_acpi_thermal(global);
+	init_acpi_fan(global);
+	init_acpi_hwmon(global, NULL);
+	init_acpi_powercap(global, NULL);
+	if(acpi_metrics_prepare(global) != SUCCESS){
+		fprintf(stderr, "could not prepare metrics\n");
+		return 1;
+	}
+	/* rendering never fails for lack of space, whatever the values are */
+	if(!(buf = malloc(acpi_metrics_size()))){
+		perror("malloc");
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	if((fd = listen_on(path, port)) < 0){
+		perror("listen");
+		return 1;
+	}
+	for(;;){
+		if((c = accept(fd, NULL, NULL)) < 0)
+			continue;
+		/* the request itself does not matter, every path serves the metrics */
+		if(read(c, req, sizeof(req)) > 0){
+			refresh(global);
+			if((len = acpi_metrics_render(buf, acpi_metrics_size())) > 0){
+				write(c, header, sizeof(header) - 1);
+				write(c, buf, len);
+			} else {
+				fprintf(stderr, "could not render metrics: %d\n", len);
+				write(c, error, sizeof(error) - 1);
+			}
+		}
+		close(c);
+	}
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Client for the event stream of acpid or the legacy /proc/acpi/event.
+ *
+ * Both send one line per event: device class, bus id, event type and
+ * data, the last two in hex, for example "ac_adapter ACPI0003:00
+ * 00000080 00000000". Newer acpid versions report the lid as
+ * "button/lid LID close". The descriptor is non-blocking, partial lines
+ * are kept until the rest arrives.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "libacpi.h"
+
+static int fd = -1;
+static char buf[MAX_BUF];
+static size_t len;
+
+/* connect to a unix socket or open a file, non-blocking */
+static int
+open_stream(const char *path){
+	struct sockaddr_un un;
+	struct stat st;
+	int s;
+
+	if(stat(path, &st) < 0)
+		return -1;
+	if(!S_ISSOCK(st.st_mode))
+		return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if((s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	snprintf(un.sun_path, sizeof(un.sun_path), "%s", path);
+	if(connect(s, (struct sockaddr *)&un, sizeof(un)) < 0){
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+/* open the event stream, acpid first */
+int
+acpi_acpid_open(const char *path){
+	acpi_acpid_close();
+	if(path)
+		fd = open_stream(path);
+	else if((fd = open_stream(ACPID_SOCKET)) < 0)
+		fd = open_stream(PROC_ACPI "event");
+	return fd >= 0 ? fd : NOT_SUPPORTED;
+}
+
+void
+acpi_acpid_close(void){
+	if(fd >= 0)
+		close(fd);
+	fd = -1;
+	len = 0;
+}
+
+/* the battery whose device link ends in bus_id, -1 if there is none */
+static int
+find_battery(global_t *globals, const char *bus_id){
+	char link[MAX_NAME];
+	const char *base;
+	ssize_t n;
+	int i;
+
+	for(i = 0; i < globals->batt_count; i++){
+		if((n = readlinkat(batteries[i].dir_fd, "device", link, sizeof(link) - 1)) <= 0)
+			continue;
+		link[n] = '\0';
+		base = strrchr(link, '/');
+		if(!strcmp(base ? base + 1 : link, bus_id))
+			return i;
+	}
+	return -1;
+}
+
+/* classify an event line and refresh the devices it is about */
+static void
+parse_event(global_t *globals, char *line, acpid_event_t *ev){
+	char action[16];
+	int i;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->num = -1;
+	ev->value = NOT_SUPPORTED;
+	action[0] = '\0';
+	if(sscanf(line, "%31s %31s %x %x", ev->device_class, ev->bus_id, &ev->code, &ev->data) < 4){
+		/* "close" starts with a hex digit */
+		ev->code = ev->data = 0;
+		sscanf(line, "%31s %31s %15s", ev->device_class, ev->bus_id, action);
+	}
+
+	if(!strcmp(ev->device_class, "button/lid")){
+		ev->type = EV_LID;
+		if(!strcmp(action, "open"))
+			ev->value = 1;
+		else if(!strcmp(action, "close"))
+			ev->value = 0;
+	} else if(!strcmp(ev->device_class, "button/power"))
+		ev->type = EV_POWER_BUTTON;
+	else if(!strcmp(ev->device_class, "button/sleep"))
+		ev->type = EV_SLEEP_BUTTON;
+	else if(!strcmp(ev->device_class, "ac_adapter")){
+		ev->type = EV_AC;
+		ev->value = ev->data ? P_AC : P_BATT;
+		ev->num = 0;
+		acpi_sampler_lock();
+		read_acpi_acstate(globals);
+		acpi_sampler_unlock();
+	} else if(!strcmp(ev->device_class, "battery")){
+		ev->type = EV_BATTERY;
+		ev->value = ev->data;
+		acpi_sampler_lock();
+		/* the battery may have been inserted, read it even if it was
+		 * backed off. Without a matching device link all batteries are read */
+		if((ev->num = find_battery(globals, ev->bus_id)) >= 0){
+			acpi_backoff_reset(batteries[ev->num].dir);
+			read_acpi_batt(ev->num);
+		} else
+			for(i = 0; i < globals->batt_count; i++){
+				acpi_backoff_reset(batteries[i].dir);
+				read_acpi_batt(i);
+			}
+		acpi_sampler_unlock();
+	} else if(!strcmp(ev->device_class, "thermal_zone")){
+		ev->type = EV_THERMAL;
+		ev->value = ev->data;
+	} else
+		ev->type = EV_OTHER;
+}
+
+/* take the next event, reading more of the stream if no line is complete */
+int
+acpi_acpid_read(global_t *globals, acpid_event_t *ev){
+	char *nl;
+	ssize_t n;
+
+	if(fd < 0)
+		return NOT_SUPPORTED;
+	while((nl = memchr(buf, '\n', len)) == NULL){
+		/* a line longer than the buffer is garbage */
+		if(len == sizeof(buf))
+			len = 0;
+		if((n = read(fd, buf + len, sizeof(buf) - len)) < 0)
+			return errno == EAGAIN || errno == EINTR ? NOT_PRESENT : NOT_SUPPORTED;
+		if(n == 0)
+			/* acpid went away */
+			return NOT_SUPPORTED;
+		len += n;
+	}
+	*nl = '\0';
+	parse_event(globals, buf, ev);
+	len -= nl + 1 - buf;
+	memmove(buf, nl + 1, len);
+	return SUCCESS;
+}
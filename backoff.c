@@ -0,0 +1,180 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Exponential backoff of attribute files which keep failing.
+ *
+ * An empty battery slot or a broken firmware method fails the same reads
+ * on every refresh, some of them only after an embedded controller
+ * timeout. Every failed read of an attribute doubles the time until it is
+ * tried again, up to the maximum; attributes retried at the maximum are
+ * in quarantine. The delay is jittered by up to half its length so the
+ * retries of devices which failed together spread out. A successful read
+ * forgets the failures.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "libacpi.h"
+#include "backoff.h"
+
+typedef struct {
+	const char *dir;             /* interned directory, NULL for full paths */
+	const char *attr;            /* interned or literal name, NULL if unused */
+	int failures;                /* consecutive failed reads */
+	unsigned long skipped;       /* reads skipped since the first failure */
+	long long retry;             /* monotonic time of the next try */
+} backoff_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static backoff_t table[BACKOFF_SLOTS];
+static atomic_llong base_delay, max_delay;
+static uint64_t seed;
+
+static long long
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* xorshift, called with the lock held */
+static uint64_t
+jitter_rand(void){
+	if(!seed)
+		seed = (uint64_t)now_ns() | 1;
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed;
+}
+
+/* delay after the given number of consecutive failures */
+static long long
+backoff_delay(int failures){
+	long long delay = atomic_load(&base_delay), max = atomic_load(&max_delay);
+
+	while(--failures > 0 && delay < max)
+		delay <<= 1;
+	return delay < max ? delay : max;
+}
+
+/* find the entry of an attribute, the strings are interned so the
+ * pointers identify it. With add set a new one is made for unknown
+ * attributes in an unused slot or, if the table is full, in the slot of
+ * an attribute which reads fine again. Called with the lock held, NULL if
+ * there is none */
+static backoff_t *
+find_entry(const char *dir, const char *attr, const int add){
+	backoff_t *b, *pick = NULL;
+	int i;
+
+	for(i = 0; i < BACKOFF_SLOTS; i++){
+		b = &table[i];
+		if(b->attr == attr && b->dir == dir)
+			return b;
+		if(!b->failures && (!pick || (pick->attr && !b->attr)))
+			pick = b;
+	}
+	if(!add || !pick)
+		return NULL;
+	memset(pick, 0, sizeof(*pick));
+	pick->dir = dir;
+	pick->attr = attr;
+	return pick;
+}
+
+int
+backoff_skip(const char *dir, const char *attr){
+	backoff_t *b;
+	int skip = 0;
+
+	if(!atomic_load(&base_delay))
+		return 0;
+	pthread_mutex_lock(&lock);
+	if((b = find_entry(dir, attr, 0)) && b->failures && now_ns() < b->retry){
+		b->skipped++;
+		skip = 1;
+	}
+	pthread_mutex_unlock(&lock);
+	return skip;
+}
+
+void
+backoff_result(const char *dir, const char *attr, const int ok){
+	long long delay;
+	backoff_t *b;
+
+	if(!atomic_load(&base_delay))
+		return;
+	pthread_mutex_lock(&lock);
+	if((b = find_entry(dir, attr, !ok)) == NULL){
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	if(ok){
+		b->failures = 0;
+		b->skipped = 0;
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	delay = backoff_delay(++b->failures);
+	b->retry = now_ns() + delay / 2 + (long long)(jitter_rand() % (uint64_t)(delay / 2 + 1));
+	pthread_mutex_unlock(&lock);
+}
+
+/* set the delays, base_ms 0 turns the backoff off and forgets all failures */
+int
+acpi_backoff_set(const int base_ms, const int max_ms){
+	if(base_ms < 0 || max_ms < base_ms)
+		return NOT_SUPPORTED;
+	pthread_mutex_lock(&lock);
+	atomic_store(&base_delay, base_ms * 1000000LL);
+	atomic_store(&max_delay, max_ms * 1000000LL);
+	if(!base_ms)
+		memset(table, 0, sizeof(table));
+	pthread_mutex_unlock(&lock);
+	return SUCCESS;
+}
+
+/* forget the failures of the attributes in dir, of all if dir is NULL */
+void
+acpi_backoff_reset(const char *dir){
+	int i;
+
+	pthread_mutex_lock(&lock);
+	for(i = 0; i < BACKOFF_SLOTS; i++)
+		if(table[i].failures && (!dir || (table[i].dir && !strcmp(table[i].dir, dir)))){
+			table[i].failures = 0;
+			table[i].skipped = 0;
+		}
+	pthread_mutex_unlock(&lock);
+}
+
+/* copy up to n backed off attributes into list */
+int
+acpi_quarantine(acpi_quarantine_t *list, const int n){
+	long long now = now_ns();
+	backoff_t *b;
+	int i, count = 0;
+
+	pthread_mutex_lock(&lock);
+	for(i = 0; i < BACKOFF_SLOTS && count < n; i++){
+		b = &table[i];
+		if(!b->failures)
+			continue;
+		list[count].dir = b->dir;
+		list[count].attr = b->attr;
+		list[count].failures = b->failures;
+		list[count].skipped = b->skipped;
+		list[count].retry_ms = b->retry > now ? (int)((b->retry - now) / 1000000) : 0;
+		list[count].quarantined = backoff_delay(b->failures) >= atomic_load(&max_delay);
+		count++;
+	}
+	pthread_mutex_unlock(&lock);
+	return count;
+}
@@ -0,0 +1,32 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ */
+
+/**
+ * \file backoff.h
+ * \brief backoff of failing attribute files, internal interface
+ */
+
+/*
+ * The attributes are identified by the dir and attr pointers, which are
+ * also kept for acpi_quarantine(). Both must be interned strings or
+ * literals: the same attribute has to come with the same pointers on
+ * every read, and they must stay valid until the devices are closed.
+ */
+
+/**
+ * Tells if an attribute is backed off and must not be read now
+ * @param dir interned directory of the device, NULL if attr is a full path
+ * @param attr interned or literal name of the attribute
+ * @return 1 if the read is to be skipped, 0 otherwise
+ */
+int backoff_skip(const char *dir, const char *attr);
+
+/**
+ * Records the result of a read, a failure backs the attribute off
+ * @param dir interned directory of the device, kept for acpi_quarantine()
+ * @param attr interned or literal name of the attribute, kept for acpi_quarantine()
+ * @param ok 1 if the read succeeded, 0 if it failed
+ */
+void backoff_result(const char *dir, const char *attr, const int ok);
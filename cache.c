@@ -0,0 +1,222 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Stale-while-revalidate cache for batteries and thermal zones.
+ *
+ * Reading a battery makes the kernel talk to the embedded controller,
+ * which can take up to 100 ms. Callers of the cache get a copy of the last
+ * values right away. If it is older than the max age a worker thread
+ * refreshes the device, one request at a time: callers arriving while a
+ * refresh is pending or running do not start another one.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libacpi.h"
+
+enum {
+	CACHE_BATT,
+	CACHE_ZONE,
+	CACHE_CLASSES
+};
+
+typedef struct {
+	long long stamp;     /* time of the last refresh, 0 before the first */
+	int pending;         /* a refresh was requested */
+	int inflight;        /* the worker is refreshing the device */
+} cache_slot_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static int running, stopping;
+static global_t *globals;
+static int counts[CACHE_CLASSES];
+static long long max_age;
+static unsigned long refreshes;
+
+static cache_slot_t slots[CACHE_CLASSES][MAX_ITEMS];
+static battery_t batt_copy[MAX_ITEMS];
+static thermal_t zone_copy[MAX_ITEMS];
+
+static long long
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* find a slot with a pending refresh, called with the lock held */
+static int
+next_pending(int *cls, int *num){
+	int c, n;
+
+	for(c = 0; c < CACHE_CLASSES; c++)
+		for(n = 0; n < MAX_ITEMS; n++)
+			if(slots[c][n].pending){
+				*cls = c;
+				*num = n;
+				return 1;
+			}
+	return 0;
+}
+
+static void *
+worker_main(void *unused){
+	battery_t batt;
+	thermal_t zone;
+	cache_slot_t *s;
+	int cls, num;
+
+	(void)unused;
+	pthread_mutex_lock(&lock);
+	while(!stopping){
+		if(!next_pending(&cls, &num)){
+			pthread_cond_wait(&wake, &lock);
+			continue;
+		}
+		s = &slots[cls][num];
+		s->pending = 0;
+		s->inflight = 1;
+		pthread_mutex_unlock(&lock);
+
+		/* the slow read goes into a copy and runs without any lock,
+		 * callers keep getting the old copy meanwhile. The sampler
+		 * lock is only held to take the copy and to publish it */
+		acpi_sampler_lock();
+		if(cls == CACHE_BATT)
+			batt = batteries[num];
+		else
+			zone = thermals[num];
+		acpi_sampler_unlock();
+
+		if(cls == CACHE_BATT)
+			read_acpi_batt_copy(num, &batt);
+		else
+			read_acpi_zone_copy(num, &zone);
+
+		acpi_sampler_lock();
+		if(cls == CACHE_BATT)
+			batteries[num] = batt;
+		else {
+			thermals[num] = zone;
+			if(counts[CACHE_ZONE] == 1)
+				globals->temperature = zone.temperature;
+		}
+		acpi_sampler_unlock();
+
+		pthread_mutex_lock(&lock);
+		if(cls == CACHE_BATT)
+			batt_copy[num] = batt;
+		else
+			zone_copy[num] = zone;
+		s->stamp = now_ns();
+		s->inflight = 0;
+		refreshes++;
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* copy the cached device num out of copies and request a refresh if it
+ * is too old */
+static int
+cache_get(const int cls, const int num, void *out, const void *copies, const size_t size,
+		long long *stamp){
+	cache_slot_t *s;
+
+	pthread_mutex_lock(&lock);
+	if(!running){
+		pthread_mutex_unlock(&lock);
+		return DISABLED;
+	}
+	if(num < 0 || num >= counts[cls]){
+		pthread_mutex_unlock(&lock);
+		return ITEM_EXCEED;
+	}
+	s = &slots[cls][num];
+	memcpy(out, (const char *)copies + num * size, size);
+	if(stamp)
+		*stamp = s->stamp;
+	if(!s->pending && !s->inflight && now_ns() - s->stamp > max_age){
+		s->pending = 1;
+		pthread_cond_signal(&wake);
+	}
+	pthread_mutex_unlock(&lock);
+	return SUCCESS;
+}
+
+/* start the cache with the values the devices hold now */
+int
+acpi_cache_start(global_t *g, const int max_age_ms){
+	int i;
+
+	/* the sampler may be refreshing the arrays, its lock is taken first
+	 * and never while holding the cache lock */
+	acpi_sampler_lock();
+	pthread_mutex_lock(&lock);
+	if(running){
+		pthread_mutex_unlock(&lock);
+		acpi_sampler_unlock();
+		return DISABLED;
+	}
+	globals = g;
+	/* the counts are only read under the cache lock from now on */
+	counts[CACHE_BATT] = g->batt_count;
+	counts[CACHE_ZONE] = g->thermal_count;
+	max_age = max_age_ms * 1000000LL;
+	memset(slots, 0, sizeof(slots));
+	for(i = 0; i < MAX_ITEMS; i++){
+		batt_copy[i] = batteries[i];
+		zone_copy[i] = thermals[i];
+	}
+	acpi_sampler_unlock();
+	refreshes = 0;
+	stopping = 0;
+	if(pthread_create(&worker, NULL, worker_main, NULL)){
+		pthread_mutex_unlock(&lock);
+		return NOT_SUPPORTED;
+	}
+	running = 1;
+	pthread_mutex_unlock(&lock);
+	return SUCCESS;
+}
+
+/* stop the worker, a refresh in flight is finished first */
+void
+acpi_cache_stop(void){
+	pthread_mutex_lock(&lock);
+	if(!running){
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	stopping = 1;
+	running = 0;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(worker, NULL);
+}
+
+int
+acpi_cache_batt(const int num, battery_t *batt, long long *stamp){
+	return cache_get(CACHE_BATT, num, batt, batt_copy, sizeof(battery_t), stamp);
+}
+
+int
+acpi_cache_zone(const int num, thermal_t *zone, long long *stamp){
+	return cache_get(CACHE_ZONE, num, zone, zone_copy, sizeof(thermal_t), stamp);
+}
+
+/* number of refreshes done by the worker */
+unsigned long
+acpi_cache_refreshes(void){
+	unsigned long n;
+
+	pthread_mutex_lock(&lock);
+	n = refreshes;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
@@ -9,6 +9,9 @@ MANPREFIX = ${PREFIX}/share/man
 # flags
 SOFLAGS = -shared -Wl,-soname,${SONAME}
 CFLAGS += -fPIC -g --pedantic -Wall -Wextra
+LDFLAGS += -lpthread -lm
+# libacpi.c only, the acpi_batch_calc() loops are vectorized from -O3 on
+VECFLAGS = -O3
 
 # Compiler and linker
 CC = cc
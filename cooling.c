@@ -0,0 +1,314 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Closed loop control of the cooling devices of thermal zones.
+ *
+ * A loop drives all cooling devices linked from a sysfs zone (cdevN) to
+ * one cooling level, computed by a PID controller around a target
+ * temperature or looked up in a temperature curve. The level is a
+ * fraction of max_state of every device. acpi_cool_step() runs all loops
+ * and writes the new states in one pass: only changed states, and at
+ * most once per period of the loop. Stopping restores the states and the
+ * zone mode found at the start, this is also done at exit().
+ *
+ * With zone_dir set a loop drives that directory instead of a zone in
+ * thermals[], reading its temp file directly. A fixture tree whose temp
+ * follows the cur_state writes simulates the thermal response.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "libacpi.h"
+#include "list.h"
+
+typedef struct {
+	int dir_fd;                  /* cooling device directory */
+	int state_fd;                /* cur_state, open for writing */
+	int max_state;
+	int orig_state;              /* cur_state before the loop started */
+	int state;                   /* last written state */
+} cdev_t;
+
+typedef struct {
+	acpi_cool_config_t cfg;
+	int zone_fd;                 /* own handle of the zone directory */
+	cdev_t cdevs[COOL_CDEVS];
+	int count;
+	int temp;                    /* last read temperature */
+	int mode_changed;            /* the zone mode was set to disabled */
+	int level;                   /* last level in per mille of max_state */
+	double integral;
+	double last_error;
+	long long last_ns;           /* time of the last step, 0 before the first */
+	long long written_ns;        /* time of the last write */
+	unsigned long writes;
+} loop_t;
+
+static loop_t loops[COOL_LOOPS];
+static int loop_count;
+static int at_exit;
+
+static long long
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* read a decimal attribute relative to dirfd into v, returns SUCCESS or
+ * NOT_SUPPORTED if it cannot be read */
+static int
+read_int_at(const int dirfd, const char *attr, int *v){
+	char buf[32];
+	ssize_t n;
+	int fd;
+
+	if((fd = openat(dirfd, attr, O_RDONLY | O_CLOEXEC)) < 0)
+		return NOT_SUPPORTED;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(n <= 0)
+		return NOT_SUPPORTED;
+	buf[n] = '\0';
+	*v = strtol(buf, NULL, 10);
+	return SUCCESS;
+}
+
+/* write a string to an attribute relative to dirfd, returns SUCCESS or
+ * NOT_SUPPORTED if it cannot be written */
+static int
+write_at(const int dirfd, const char *attr, const char *value){
+	int fd, ret;
+
+	/* truncated like a shell redirection, for plain files of fixture trees */
+	if((fd = openat(dirfd, attr, O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0)
+		return NOT_SUPPORTED;
+	ret = write(fd, value, strlen(value)) == (ssize_t)strlen(value) ? SUCCESS : NOT_SUPPORTED;
+	close(fd);
+	return ret;
+}
+
+/* write a state through an open cur_state */
+static int
+write_state(cdev_t *c, const int state){
+	char buf[16];
+	int n = snprintf(buf, sizeof(buf), "%d\n", state);
+
+	if(pwrite(c->state_fd, buf, n, 0) != n)
+		return NOT_SUPPORTED;
+	c->state = state;
+	return SUCCESS;
+}
+
+/* open the cooling devices linked from a zone directory */
+static int
+open_cdevs(loop_t *l, const char *dir){
+	char path[MAX_NAME];
+	list_t *lst;
+	node_t *node;
+	cdev_t *c;
+	int n;
+
+	snprintf(path, sizeof(path), "%s", dir);
+	if((lst = dir_list(path)) == NULL)
+		return NOT_SUPPORTED;
+	for(node = lst->top; node && l->count < COOL_CDEVS; node = node->next){
+		/* cdevN links to the device, cdevN_trip_point and cdevN_weight are files */
+		if(sscanf(node->name, "cdev%d", &n) != 1 || strchr(node->name, '_'))
+			continue;
+		c = &l->cdevs[l->count];
+		if((c->dir_fd = openat(l->zone_fd, node->name, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0)
+			continue;
+		if(read_int_at(c->dir_fd, "max_state", &c->max_state) != SUCCESS ||
+				read_int_at(c->dir_fd, "cur_state", &c->orig_state) != SUCCESS ||
+				c->max_state <= 0 || c->orig_state < 0 ||
+				(c->state_fd = openat(c->dir_fd, "cur_state", O_WRONLY | O_CLOEXEC)) < 0){
+			close(c->dir_fd);
+			continue;
+		}
+		c->state = c->orig_state;
+		l->count++;
+	}
+	delete_list(lst);
+	return l->count ? SUCCESS : NOT_SUPPORTED;
+}
+
+/* put the cooling devices and the zone mode back and close everything */
+static void
+release_loop(loop_t *l){
+	int i;
+
+	for(i = 0; i < l->count; i++){
+		write_state(&l->cdevs[i], l->cdevs[i].orig_state);
+		close(l->cdevs[i].state_fd);
+		close(l->cdevs[i].dir_fd);
+	}
+	if(l->mode_changed)
+		write_at(l->zone_fd, "mode", "enabled");
+	close(l->zone_fd);
+	l->count = 0;
+}
+
+/* read the temperature of the zone of a loop in degrees Celsius into temp,
+ * returns SUCCESS or NOT_SUPPORTED if it cannot be read. Zones below zero
+ * are valid */
+static int
+loop_temp(loop_t *l, global_t *globals, int *temp){
+	thermal_t *t;
+	int ret;
+
+	if(l->cfg.zone_dir){
+		if((ret = read_int_at(l->zone_fd, "temp", temp)) == SUCCESS)
+			*temp /= 1000;
+		return ret;
+	}
+	t = &thermals[l->cfg.zone];
+	acpi_sampler_lock();
+	ret = read_acpi_zone(l->cfg.zone, globals);
+	*temp = t->temperature;
+	/* a /proc zone only reports a failed read in its temperature */
+	if(t->input_fd == -1 && t->temperature == NOT_SUPPORTED)
+		ret = NOT_SUPPORTED;
+	acpi_sampler_unlock();
+	return ret;
+}
+
+/* start a control loop for a zone, returns its number */
+int
+acpi_cool_start(global_t *globals, const acpi_cool_config_t *config){
+	const char *dir;
+	loop_t *l;
+	int i;
+
+	if(loop_count == COOL_LOOPS)
+		return ITEM_EXCEED;
+	if(!config->zone_dir && (config->zone < 0 || config->zone >= globals->thermal_count))
+		return ITEM_EXCEED;
+	if(config->policy == COOL_CURVE && (config->curve_points < 1 || config->curve_points > COOL_CURVE_POINTS))
+		return NOT_SUPPORTED;
+	dir = config->zone_dir ? config->zone_dir : thermals[config->zone].dir;
+	for(i = 0; i < loop_count; i++)
+		if(!strcmp(loops[i].cfg.zone_dir ? loops[i].cfg.zone_dir : thermals[loops[i].cfg.zone].dir, dir))
+			return DISABLED;
+
+	l = &loops[loop_count];
+	memset(l, 0, sizeof(*l));
+	l->cfg = *config;
+	/* the loop keeps its own handle, it outlives close_acpi() for the
+	 * restore at exit */
+	if(config->zone_dir)
+		l->zone_fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	else
+		l->zone_fd = fcntl(thermals[config->zone].dir_fd, F_DUPFD_CLOEXEC, 0);
+	if(l->zone_fd < 0)
+		return NOT_SUPPORTED;
+	if(open_cdevs(l, dir) != SUCCESS){
+		close(l->zone_fd);
+		return NOT_SUPPORTED;
+	}
+	if(!at_exit)
+		at_exit = !atexit(acpi_cool_stop);
+	/* keep the kernel governor from undoing the writes, where allowed */
+	if(config->take_over)
+		l->mode_changed = write_at(l->zone_fd, "mode", "disabled") == SUCCESS;
+	return loop_count++;
+}
+
+/* stop all loops and restore the cooling devices */
+void
+acpi_cool_stop(void){
+	int i;
+
+	for(i = 0; i < loop_count; i++)
+		release_loop(&loops[i]);
+	loop_count = 0;
+}
+
+/* cooling level in per mille from the temperature curve */
+static int
+curve_level(const acpi_cool_config_t *cfg, const int temp){
+	const int *t = cfg->curve_temp, *p = cfg->curve_level;
+	int i, n = cfg->curve_points;
+
+	if(temp <= t[0])
+		return p[0];
+	for(i = 1; i < n; i++)
+		if(temp < t[i])
+			return p[i - 1] + (p[i] - p[i - 1]) * (temp - t[i - 1]) / (t[i] - t[i - 1]);
+	return p[n - 1];
+}
+
+/* cooling level in per mille from the PID controller */
+static int
+pid_level(loop_t *l, const int temp, const long long ns){
+	const acpi_cool_config_t *cfg = &l->cfg;
+	double error = temp - cfg->target, dt, deriv = 0, out;
+
+	dt = l->last_ns ? (ns - l->last_ns) / 1e9 : 0;
+	if(dt > 0)
+		deriv = (error - l->last_error) / dt;
+	out = cfg->kp * error + cfg->ki * (l->integral + error * dt) + cfg->kd * deriv;
+	/* only integrate while the output is not saturated, or it winds up */
+	if((out < 1000 || error < 0) && (out > 0 || error > 0))
+		l->integral += error * dt;
+	l->last_error = error;
+	return out < 0 ? 0 : out > 1000 ? 1000 : (int)out;
+}
+
+/* run all loops once, returns the number of written states */
+int
+acpi_cool_step(global_t *globals){
+	long long ns = now_ns();
+	loop_t *l;
+	cdev_t *c;
+	int i, j, temp, state, writes = 0;
+
+	for(i = 0; i < loop_count; i++){
+		l = &loops[i];
+		if(loop_temp(l, globals, &temp) != SUCCESS)
+			continue;
+		l->temp = temp;
+
+		l->level = l->cfg.policy == COOL_CURVE ? curve_level(&l->cfg, temp) : pid_level(l, temp, ns);
+		if(l->level < 0) l->level = 0;
+		if(l->level > 1000) l->level = 1000;
+		l->last_ns = ns;
+		if(l->written_ns && ns - l->written_ns < l->cfg.period_ms * 1000000LL)
+			continue;
+
+		for(j = 0; j < l->count; j++){
+			c = &l->cdevs[j];
+			state = (l->level * c->max_state + 500) / 1000;
+			if(state != c->state && write_state(c, state) == SUCCESS){
+				writes++;
+				l->writes++;
+				l->written_ns = ns;
+			}
+		}
+	}
+	return writes;
+}
+
+/* copy the state of a loop */
+int
+acpi_cool_status(const int loop, acpi_cool_status_t *status){
+	int j;
+
+	if(loop < 0 || loop >= loop_count)
+		return ITEM_EXCEED;
+	status->temperature = loops[loop].temp;
+	status->level = loops[loop].level;
+	status->devices = loops[loop].count;
+	status->writes = loops[loop].writes;
+	status->take_over = loops[loop].mode_changed;
+	for(j = 0; j < loops[loop].count && j < COOL_CDEVS; j++)
+		status->state[j] = loops[loop].cdevs[j].state;
+	return SUCCESS;
+}
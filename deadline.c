@@ -0,0 +1,290 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Deadlines for attribute reads.
+ *
+ * A read of a battery attribute is a transaction with the embedded
+ * controller and blocks until the firmware answers, which can take seconds.
+ * With deadlines set the read is handed to one of a few reader threads and
+ * the caller waits at most until the attribute or refresh deadline. A read
+ * missing it is left to finish on the reader, its result still becomes
+ * the last good content of the attribute. The caller gets the last good
+ * content right away and the refresh returns STALE. While a read of an
+ * attribute is pending, or all readers are busy, no new read is started.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "libacpi.h"
+#include "deadline.h"
+
+/* longest attribute name with a last good content */
+#define LAST_NAME 64
+
+/* last good content of an attribute */
+typedef struct {
+	const char *dir;             /* interned directory of the device, NULL for full paths */
+	char attr[LAST_NAME];        /* name of the attribute, empty if the slot is unused */
+	long long used;              /* monotonic time of the last lookup */
+	int len;                     /* -1 before the first good read */
+	int pending;                 /* a reader is still at it */
+	char data[MAX_BUF];
+} last_t;
+
+typedef struct {
+	pthread_t thread;
+	pthread_cond_t wake;
+	int started;
+	int fd;                      /* descriptor to read, -1 while idle */
+	int busy;                    /* handed out, until the result was taken */
+	int finished;                /* the result is ready for the caller */
+	int abandoned;               /* the caller gave up waiting */
+	last_t *slot;
+	int len;
+	char buf[MAX_BUF];
+} reader_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static reader_t readers[DEADLINE_READERS];
+static last_t last[DEADLINE_SLOTS];
+static atomic_llong attr_limit, refresh_limit;
+static atomic_ulong misses;
+
+/* per thread, refreshes run on the sampler, cache and caller threads */
+static _Thread_local long long refresh_end;
+static _Thread_local int stale;
+
+static long long
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* the waits are on the monotonic clock, like the deadlines */
+static void
+init_done(void){
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&done, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/* find or add the slot of an attribute, called with the lock held. A new
+ * attribute takes a free slot or the one used longest ago, returns NULL if
+ * the name is too long or every slot has a read pending */
+static last_t *
+find_slot(const char *dir, const char *attr, const long long now){
+	last_t *l, *pick = NULL;
+	int i;
+
+	if(strlen(attr) >= LAST_NAME)
+		return NULL;
+	for(i = 0; i < DEADLINE_SLOTS; i++){
+		l = &last[i];
+		if(l->attr[0] && l->dir == dir && !strcmp(l->attr, attr)){
+			l->used = now;
+			return l;
+		}
+		if(l->pending)
+			continue;
+		if(!pick || (pick->attr[0] && (!l->attr[0] || l->used < pick->used)))
+			pick = l;
+	}
+	if(pick){
+		pick->dir = dir;
+		strcpy(pick->attr, attr);
+		pick->used = now;
+		pick->len = -1;
+	}
+	return pick;
+}
+
+static void *
+reader_main(void *arg){
+	reader_t *r = arg;
+	int fd, len;
+
+	pthread_mutex_lock(&lock);
+	for(;;){
+		while(r->fd < 0)
+			pthread_cond_wait(&r->wake, &lock);
+		fd = r->fd;
+		pthread_mutex_unlock(&lock);
+
+		/* this is the read that may hang */
+		len = pread(fd, r->buf, sizeof(r->buf), 0);
+		close(fd);
+
+		pthread_mutex_lock(&lock);
+		r->fd = -1;
+		r->len = len;
+		if(r->slot){
+			if(len >= 0){
+				memcpy(r->slot->data, r->buf, len);
+				r->slot->len = len;
+			}
+			r->slot->pending = 0;
+		}
+		if(r->abandoned)
+			r->busy = 0;
+		else
+			r->finished = 1;
+		pthread_cond_broadcast(&done);
+	}
+	return NULL;
+}
+
+/* an idle reader, its thread is started on first use. Called with the
+ * lock held, returns NULL if all readers are busy */
+static reader_t *
+idle_reader(void){
+	reader_t *r;
+	int i;
+
+	for(i = 0; i < DEADLINE_READERS; i++){
+		r = &readers[i];
+		if(r->busy)
+			continue;
+		if(!r->started){
+			r->fd = -1;
+			pthread_cond_init(&r->wake, NULL);
+			if(pthread_create(&r->thread, NULL, reader_main, r))
+				return NULL;
+			pthread_detach(r->thread);
+			r->started = 1;
+		}
+		return r;
+	}
+	return NULL;
+}
+
+int
+deadline_read(const int fd, const int keep, const char *dir, const char *attr,
+		char *buf, const size_t size, int *served){
+	long long limit = atomic_load(&attr_limit), now, end;
+	struct timespec ts;
+	reader_t *r = NULL;
+	last_t *slot;
+	int len = -1, rfd;
+
+	*served = SERVED_READ;
+	if(!limit && !refresh_end){
+		len = pread(fd, buf, size, 0);
+		if(!keep)
+			close(fd);
+		return len;
+	}
+	pthread_once(&once, init_done);
+	now = now_ns();
+	end = limit ? now + limit : refresh_end;
+	if(refresh_end && refresh_end < end)
+		end = refresh_end;
+
+	pthread_mutex_lock(&lock);
+	slot = find_slot(dir, attr, now);
+	if(slot && slot->pending){
+		*served = SERVED_HUNG;
+		goto fallback;
+	}
+	if(now >= end || (r = idle_reader()) == NULL || (rfd = keep ? dup(fd) : fd) < 0){
+		r = NULL;
+		*served = SERVED_SKIPPED;
+		goto fallback;
+	}
+	r->busy = 1;
+	r->finished = r->abandoned = 0;
+	r->slot = slot;
+	r->fd = rfd;
+	if(slot)
+		slot->pending = 1;
+	pthread_cond_signal(&r->wake);
+
+	ts.tv_sec = end / 1000000000LL;
+	ts.tv_nsec = end % 1000000000LL;
+	while(!r->finished)
+		if(pthread_cond_timedwait(&done, &lock, &ts) == ETIMEDOUT)
+			break;
+	if(r->finished){
+		if((len = r->len) > (int)size)
+			len = size;
+		if(len > 0)
+			memcpy(buf, r->buf, len);
+		r->busy = 0;
+		pthread_mutex_unlock(&lock);
+		return len;
+	}
+	r->abandoned = 1;
+	atomic_fetch_add(&misses, 1);
+	*served = SERVED_HUNG;
+
+fallback:
+	stale = 1;
+	len = READ_MISSED;
+	if(slot && slot->len >= 0){
+		len = slot->len < (int)size ? slot->len : (int)size;
+		memcpy(buf, slot->data, len);
+	}
+	pthread_mutex_unlock(&lock);
+	if(!r && !keep)
+		close(fd);
+	return len;
+}
+
+void
+deadline_clear(void){
+	int i;
+
+	pthread_mutex_lock(&lock);
+	memset(last, 0, sizeof(last));
+	/* reads still pending must not fill the slots of other attributes */
+	for(i = 0; i < DEADLINE_READERS; i++)
+		readers[i].slot = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+void
+deadline_begin(void){
+	long long limit = atomic_load(&refresh_limit);
+
+	stale = 0;
+	refresh_end = limit ? now_ns() + limit : 0;
+}
+
+int
+deadline_end(const int ret){
+	refresh_end = 0;
+	return ret == SUCCESS && stale ? STALE : ret;
+}
+
+/* set the deadlines, 0 turns a deadline off */
+int
+acpi_deadline_set(const int attr_ms, const int refresh_ms){
+	if(attr_ms < 0 || refresh_ms < 0)
+		return NOT_SUPPORTED;
+	atomic_store(&attr_limit, attr_ms * 1000000LL);
+	atomic_store(&refresh_limit, refresh_ms * 1000000LL);
+	return SUCCESS;
+}
+
+/* true if the last refresh on this thread used last good content */
+int
+acpi_deadline_stale(void){
+	return stale;
+}
+
+/* reads which missed their deadline */
+unsigned long
+acpi_deadline_misses(void){
+	return atomic_load(&misses);
+}
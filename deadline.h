@@ -0,0 +1,54 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ */
+
+/**
+ * \file deadline.h
+ * \brief deadline bounded attribute reads, internal interface
+ */
+
+/* deadline_read() could not answer in time, this says nothing about the file */
+#define READ_MISSED -2
+
+/* how deadline_read() answered */
+#define SERVED_READ 0     /* the file was read */
+#define SERVED_SKIPPED 1  /* no time or reader was left, the file was not read */
+#define SERVED_HUNG 2     /* the read missed its deadline or an earlier one still hangs */
+
+/**
+ * Reads up to size bytes from the start of an attribute. Without
+ * deadlines this is a plain pread(). With deadlines the read runs on a
+ * reader thread; if it misses the deadline the last good content of the
+ * attribute is returned instead and the refresh is marked stale.
+ * @param fd open descriptor of the attribute
+ * @param keep 0 if fd is to be closed after the read, 1 if the caller keeps it
+ * @param dir interned directory of the device, NULL if attr is a full path
+ * @param attr name of the attribute, with dir it identifies the last good content
+ * @param buf filled with the content
+ * @param size room in buf
+ * @param served set to SERVED_READ if buf holds what the file returned now,
+ * otherwise to the reason the last good content was used
+ * @return number of bytes read, -1 on errors or READ_MISSED if the read
+ * missed its deadline and there is no last good content
+ */
+int deadline_read(const int fd, const int keep, const char *dir, const char *attr,
+		char *buf, const size_t size, int *served);
+
+/**
+ * Forgets the last good content of all attributes, called when the
+ * devices are closed
+ */
+void deadline_clear(void);
+
+/**
+ * Starts the refresh deadline of a device on the calling thread
+ */
+void deadline_begin(void);
+
+/**
+ * Ends the refresh started with deadline_begin()
+ * @param ret result of the refresh
+ * @return ret, or STALE if it is SUCCESS but a read missed its deadline
+ */
+int deadline_end(const int ret);
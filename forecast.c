@@ -0,0 +1,178 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Temperature trend of the thermal zones and time to their trip points.
+ *
+ * Every refresh of a zone adds the temperature to a short ring. A least
+ * squares line through the ring gives the trend. The rates between
+ * neighbouring readings are fitted against the temperature as well: if
+ * they fall while the zone heats up it behaves like a first order system
+ * dT/dt = (limit - T) / tau, which settles at limit instead of running
+ * into the trip point the straight line predicts.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "libacpi.h"
+#include "forecast.h"
+
+typedef struct {
+	long long ns[FORECAST_SAMPLES];
+	int temp[FORECAST_SAMPLES];
+	int count;                   /* readings in the ring */
+	int next;                    /* slot of the next reading */
+} history_t;
+
+/* longest time constant of the model in multiples of the window */
+#define MODEL_SPAN 4
+/* INT_MAX, limits.h clashes with LINE_MAX of libacpi.h */
+#define INT_LIMIT ((double)(~0u >> 1))
+
+/* the history is added to from the sampler and the cache worker */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static history_t history[MAX_ITEMS];
+
+void
+forecast_add(const int num, const long long ns, const int temp){
+	history_t *h;
+
+	if(num < 0 || num >= MAX_ITEMS)
+		return;
+	pthread_mutex_lock(&lock);
+	h = &history[num];
+	h->ns[h->next] = ns;
+	h->temp[h->next] = temp;
+	h->next = (h->next + 1) % FORECAST_SAMPLES;
+	if(h->count < FORECAST_SAMPLES)
+		h->count++;
+	pthread_mutex_unlock(&lock);
+}
+
+void
+forecast_reset(const int num){
+	if(num < 0 || num >= MAX_ITEMS)
+		return;
+	pthread_mutex_lock(&lock);
+	memset(&history[num], 0, sizeof(history_t));
+	pthread_mutex_unlock(&lock);
+}
+
+/* v as an int, values beyond the int range are clamped to it. Converting
+ * an out of range double is undefined */
+static int
+clamp_int(const double v){
+	if(isnan(v))
+		return 0;
+	return v >= INT_LIMIT ? INT_LIMIT : v <= -INT_LIMIT ? -INT_LIMIT : (int)v;
+}
+
+/* seconds rounded up, NOT_SUPPORTED if they are not finite, negative or
+ * do not fit an int, e.g. for a nearly flat trend */
+static int
+ceil_seconds(const double s){
+	if(!isfinite(s) || s < 0 || s >= INT_LIMIT)
+		return NOT_SUPPORTED;
+	return (int)ceil(s);
+}
+
+/* least squares line y = a + b * x, returns 0 if x does not vary */
+static int
+fit_line(const double *x, const double *y, const int n, double *a, double *b){
+	double mx = 0, my = 0, sxx = 0, sxy = 0;
+	int i;
+
+	for(i = 0; i < n; i++){
+		mx += x[i];
+		my += y[i];
+	}
+	mx /= n;
+	my /= n;
+	for(i = 0; i < n; i++){
+		sxx += (x[i] - mx) * (x[i] - mx);
+		sxy += (x[i] - mx) * (y[i] - my);
+	}
+	if(sxx <= 0)
+		return 0;
+	*b = sxy / sxx;
+	*a = my - *b * mx;
+	return 1;
+}
+
+/* the lowest passive, hot or critical trip point above temp, the highest
+ * one if the zone is above all of them. -1 if the zone has none */
+static int
+next_trip(const thermal_t *info, const double temp){
+	int i, next = -1, top = -1;
+
+	for(i = 0; i < info->trip_count; i++){
+		if(info->trips[i].type == T_ACT)
+			continue;
+		if(top < 0 || info->trips[i].temperature > info->trips[top].temperature)
+			top = i;
+		if(info->trips[i].temperature * 1000.0 > temp &&
+				(next < 0 || info->trips[i].temperature < info->trips[next].temperature))
+			next = i;
+	}
+	return next >= 0 ? next : top;
+}
+
+int
+acpi_zone_forecast(const int num, acpi_forecast_t *fc){
+	double t[FORECAST_SAMPLES], temp[FORECAST_SAMPLES];
+	double mid[FORECAST_SAMPLES], rate[FORECAST_SAMPLES];
+	double a, slope, c, rc, now, trip, limit;
+	history_t hist, *h = &hist;
+	int i, j, n, pairs = 0;
+
+	if(num < 0 || num >= MAX_ITEMS)
+		return ITEM_EXCEED;
+	pthread_mutex_lock(&lock);
+	hist = history[num];
+	pthread_mutex_unlock(&lock);
+	if((n = h->count) < 3)
+		return NOT_SUPPORTED;
+
+	/* seconds relative to the newest reading, oldest first */
+	for(i = 0; i < n; i++){
+		j = (h->next - n + i + FORECAST_SAMPLES) % FORECAST_SAMPLES;
+		t[i] = (h->ns[j] - h->ns[(h->next + FORECAST_SAMPLES - 1) % FORECAST_SAMPLES]) / 1e9;
+		temp[i] = h->temp[j];
+	}
+	if(!fit_line(t, temp, n, &a, &slope))
+		return NOT_SUPPORTED;
+	/* the line at the newest reading smooths out the sensor steps */
+	now = a;
+	if((fc->trip = next_trip(&thermals[num], now)) < 0)
+		return NOT_SUPPORTED;
+	trip = thermals[num].trips[fc->trip].temperature * 1000.0;
+	fc->temperature = clamp_int(now);
+	fc->slope = clamp_int(slope);
+	fc->limit = NOT_SUPPORTED;
+
+	for(i = 0; i + 1 < n; i++){
+		if(t[i + 1] <= t[i])
+			continue;
+		mid[pairs] = (temp[i] + temp[i + 1]) / 2;
+		rate[pairs] = (temp[i + 1] - temp[i]) / (t[i + 1] - t[i]);
+		pairs++;
+	}
+
+	/* first order system, rate = (limit - T) / tau with c = -1 / tau. A time
+	 * constant much longer than the window means no bend can be seen yet */
+	if(pairs >= 3 && slope > 0 && fit_line(mid, rate, pairs, &rc, &c) && c < 0 &&
+			-1 / c <= MODEL_SPAN * -t[0] && isfinite(limit = -rc / c) &&
+			fabs(limit) < INT_LIMIT)
+		fc->limit = (int)limit;
+
+	if(now >= trip)
+		fc->seconds = 0;
+	else if(fc->limit != NOT_SUPPORTED)
+		fc->seconds = limit > trip ? ceil_seconds(log((limit - now) / (limit - trip)) / -c) : NOT_SUPPORTED;
+	else if(slope > 0)
+		fc->seconds = ceil_seconds((trip - now) / slope);
+	else
+		fc->seconds = NOT_SUPPORTED;
+	return SUCCESS;
+}
@@ -0,0 +1,23 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ */
+
+/**
+ * \file forecast.h
+ * \brief temperature history of the thermal zones, internal interface
+ */
+
+/**
+ * Adds a reading to the history of a zone, called on every refresh
+ * @param num number of the zone
+ * @param ns monotonic time of the reading
+ * @param temp temperature in millidegrees Celsius
+ */
+void forecast_add(const int num, const long long ns, const int temp);
+
+/**
+ * Forgets the history of a zone, called when the zone is found
+ * @param num number of the zone
+ */
+void forecast_reset(const int num);
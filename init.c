@@ -0,0 +1,129 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Initialization of all device classes at once.
+ *
+ * Finding the devices is mostly waiting for directory listings and static
+ * info files, a slow embedded controller makes the battery alone take
+ * hundreds of milliseconds. The classes do not share device arrays, so
+ * each one is discovered on a thread of its own. hwmon chips append to the
+ * thermal zones and fans and are added once both are there.
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "libacpi.h"
+
+enum {
+	JOB_SUPPLIES,
+	JOB_THERMAL,
+	JOB_FAN,
+	JOB_POWERCAP,
+	JOBS
+};
+
+typedef struct {
+	int (*init)(global_t *globals);
+	global_t *globals;
+	int status;
+	long long done;              /* time the job finished */
+	int started;                 /* runs on a thread of its own */
+	pthread_t thread;
+} init_job_t;
+
+static long long
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+init_powercap(global_t *globals){
+	return init_acpi_powercap(globals, NULL);
+}
+
+static void *
+run_job(void *arg){
+	init_job_t *job = arg;
+
+	job->status = job->init(job->globals);
+	job->done = now_ns();
+	return NULL;
+}
+
+static void
+join_job(init_job_t *job){
+	if(job->started)
+		pthread_join(job->thread, NULL);
+}
+
+/* SUCCESS if devices were found, else the error of the init function */
+static int
+class_status(const int count, const int status){
+	if(count)
+		return SUCCESS;
+	return status == SUCCESS ? NOT_SUPPORTED : status;
+}
+
+int
+acpi_init_all(global_t *globals, acpi_init_result_t result[ACPI_CLASSES]){
+	init_job_t jobs[JOBS] = {
+		{ init_acpi_supplies, NULL, 0, 0, 0, 0 },
+		{ init_acpi_thermal, NULL, 0, 0, 0, 0 },
+		{ init_acpi_fan, NULL, 0, 0, 0, 0 },
+		{ init_powercap, NULL, 0, 0, 0, 0 }
+	};
+	acpi_init_result_t res[ACPI_CLASSES];
+	long long start = now_ns(), hwmon_done;
+	int i, ret = NOT_SUPPORTED;
+
+	for(i = 0; i < JOBS; i++){
+		jobs[i].globals = globals;
+		/* without a thread the job runs right here */
+		if(!(jobs[i].started = !pthread_create(&jobs[i].thread, NULL, run_job, &jobs[i])))
+			run_job(&jobs[i]);
+	}
+
+	join_job(&jobs[JOB_THERMAL]);
+	join_job(&jobs[JOB_FAN]);
+	init_acpi_hwmon(globals, NULL);
+	init_acpi_cpumap(globals, NULL);
+	hwmon_done = now_ns();
+	join_job(&jobs[JOB_SUPPLIES]);
+	join_job(&jobs[JOB_POWERCAP]);
+
+	res[ACPI_CLASS_AC].status = class_status(globals->adapt_count, jobs[JOB_SUPPLIES].status);
+	res[ACPI_CLASS_AC].ns = jobs[JOB_SUPPLIES].done - start;
+	res[ACPI_CLASS_BATTERY].status = class_status(globals->batt_count, jobs[JOB_SUPPLIES].status);
+	res[ACPI_CLASS_BATTERY].ns = jobs[JOB_SUPPLIES].done - start;
+	res[ACPI_CLASS_ZONE].status = class_status(globals->thermal_count, jobs[JOB_THERMAL].status);
+	res[ACPI_CLASS_ZONE].ns = hwmon_done - start;
+	res[ACPI_CLASS_FAN].status = class_status(globals->fan_count, jobs[JOB_FAN].status);
+	res[ACPI_CLASS_FAN].ns = hwmon_done - start;
+	res[ACPI_CLASS_POWERCAP].status = class_status(globals->powercap_count, jobs[JOB_POWERCAP].status);
+	res[ACPI_CLASS_POWERCAP].ns = jobs[JOB_POWERCAP].done - start;
+
+	for(i = 0; i < ACPI_CLASSES; i++){
+		if(res[i].status == SUCCESS)
+			ret = SUCCESS;
+		if(result)
+			result[i] = res[i];
+	}
+	return ret;
+}
+
+/* a warm start takes the devices from the cache, a cold one writes it */
+int
+acpi_init_cached(global_t *globals, const char *path){
+	int ret;
+
+	if(acpi_discovery_load(globals, path) == SUCCESS)
+		return globals->adapt_count || globals->batt_count || globals->thermal_count ||
+			globals->fan_count || globals->powercap_count ? SUCCESS : NOT_SUPPORTED;
+	ret = acpi_init_all(globals, NULL);
+	acpi_discovery_save(globals, path);
+	return ret;
+}
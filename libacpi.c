@@ -3,6 +3,7 @@
  * See LICENSE file for license details
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,21 +11,40 @@
 #include <dirent.h>
 #include <ctype.h>
 #include <stddef.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "libacpi.h"
 #include "list.h"
+#include "trace.h"
+#include "forecast.h"
+#include "deadline.h"
+#include "backoff.h"
 
 
 static int read_acpi_battinfo(const int num, const int sysstyle);
-static int read_acpi_battalarm(const int num, const int sysstyle);
-static int read_acpi_battstate(const int num);
+static int read_acpi_battalarm(battery_t *info, const int sysstyle);
+static int read_acpi_battstate(battery_t *info);
 static void read_acpi_thermalzones(global_t *globals);
 
+/* bits per word of a CPU bitmap */
+#define LONG_BITS (8 * sizeof(unsigned long))
+
 typedef struct {
 	char * value;
 	size_t offset;
 } acpi_value_t;
 
+battery_t batteries[MAX_ITEMS];
+thermal_t thermals[MAX_ITEMS];
+fan_t fans[MAX_ITEMS];
+adapter_t adapters[MAX_ITEMS];
+powercap_t powercaps[MAX_ITEMS];
+
 static acpi_value_t
 battinfo_values[] = {
 	{ "last full capacity:", offsetof(battery_t, last_full_cap) },
@@ -36,82 +56,369 @@ battinfo_values[] = {
 	{ NULL, 0 }
 };
 
-/* given a buffer for example from a file, search for key
- * and return a pointer to the value of it. On error return NULL*/
-static char *
-scan_acpi_value(const char *buf, const char *key){
-	char *ptr = NULL;
-	char *tmpbuf = NULL;
-	char *tmpkey = NULL;
-	char *tmpval = NULL;
-
-	if((tmpbuf = strdup(buf)) == NULL)
-		return NULL;
-
-	/* jump to the key in buffer */
-	if((tmpkey = strstr(tmpbuf, key))) {
-		/* jump behind the key, whitespaces and tabs */
-		for(tmpkey += strlen(key); *tmpkey && (*tmpkey == ' ' || *tmpkey == '\t'); tmpkey++);
-		for(tmpval = tmpkey; *tmpval && *tmpval != ' ' &&
-				*tmpval != '\t' && *tmpval != '\n' &&
-				*tmpval != '\r'; tmpval++);
-		if(tmpval)
-			*tmpval = '\0';
-
-		if((ptr = strdup(tmpkey)) == NULL) {
-			free(tmpbuf);
+/* extra attributes registered with acpi_attr_register(), read like the
+ * built-in ones but stored outside the device structures */
+typedef struct {
+	acpi_class_t dev_class;
+	const char *name;
+	acpi_attr_type_t type;
+	acpi_attr_refresh_t refresh;
+	const char * const *values;
+} acpi_attr_t;
+
+static acpi_attr_t attrs[MAX_ATTRS];
+static int attr_count;
+static acpi_attr_value_t attr_values[MAX_ATTRS][MAX_ITEMS];
+static char attr_loaded[MAX_ATTRS][MAX_ITEMS];
+
+/* interned device names and paths, NUL separated. The device classes
+ * can be initialized on several threads, see acpi_init_all() */
+static char strtab[STRTAB_SIZE];
+static size_t strtab_len;
+static pthread_mutex_t strtab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* set while a device is refreshed on this thread, only reads during a
+ * refresh are backed off, device discovery always reads */
+static _Thread_local int in_refresh;
+
+/* set if the last attribute read on this thread missed its deadline
+ * without a last good content to fall back on */
+static _Thread_local int read_missed;
+
+/* version of the acpi subsystem from a loaded discovery cache, 0 if none
+ * was loaded, see acpi_discovery_load() */
+static int cached_version;
+
+/* format a string and return its single copy in strtab, NULL if the table is full */
+static const char *
+intern(const char *fmt, ...){
+	char tmp[MAX_NAME];
+	va_list ap;
+	size_t pos, len;
+
+	va_start(ap, fmt);
+	vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+
+	pthread_mutex_lock(&strtab_lock);
+	for(pos = 0; pos < strtab_len; pos += strlen(strtab + pos) + 1)
+		if(!strcmp(strtab + pos, tmp))
+			break;
+	if(pos == strtab_len){
+		if(strtab_len + (len = strlen(tmp) + 1) > STRTAB_SIZE){
+			pthread_mutex_unlock(&strtab_lock);
 			return NULL;
 		}
+		memcpy(strtab + pos, tmp, len);
+		strtab_len += len;
 	}
-	free(tmpbuf);
-	return ptr;
+	pthread_mutex_unlock(&strtab_lock);
+	return strtab + pos;
+}
+
+/* returns how much of the string table is used */
+size_t
+acpi_strtab_size(void){
+	size_t len;
+
+	pthread_mutex_lock(&strtab_lock);
+	len = strtab_len;
+	pthread_mutex_unlock(&strtab_lock);
+	return len;
+}
+
+/* bumped whenever a refreshed value differs from the previous one */
+static atomic_ulong generation;
+
+/* store a new generation in a device and one of its field groups if changed */
+static void
+gen_bump(unsigned long *dev, unsigned long *field, const int changed){
+	if(changed)
+		*dev = *field = atomic_fetch_add(&generation, 1) + 1;
 }
 
-/* reads a file into a buffer and returns a pointer to it, or NULL on error */
+/* mark all field groups of a newly found device as changed */
+static void
+gen_stamp(unsigned long *dev, unsigned long *field, const int groups){
+	int i;
+
+	*dev = atomic_fetch_add(&generation, 1) + 1;
+	for(i = 0; i < groups; i++)
+		field[i] = *dev;
+}
+
+/* given a buffer for example from a file, search for key and copy
+ * the value of it into val, which has room for size bytes.
+ * Returns val or NULL if the key is not found */
 static char *
-get_acpi_content(const char *file){
-	FILE *input = NULL;
-	char *buf = NULL;
-	int read = 0;
+scan_acpi_value(const char *buf, const char *key, char *val, const size_t size){
+	const char *tmpkey = NULL;
+	size_t len = 0;
 
-	if((buf = malloc(MAX_BUF + 1)) == NULL)
+	/* jump to the key in buffer */
+	if((tmpkey = strstr(buf, key)) == NULL)
 		return NULL;
-	if((input = fopen(file, "r")) == NULL) {
-        free(buf);
+	/* jump behind the key, whitespaces and tabs */
+	for(tmpkey += strlen(key); *tmpkey && (*tmpkey == ' ' || *tmpkey == '\t'); tmpkey++);
+	for(; len + 1 < size && tmpkey[len] && tmpkey[len] != ' ' &&
+			tmpkey[len] != '\t' && tmpkey[len] != '\n' &&
+			tmpkey[len] != '\r'; len++)
+		val[len] = tmpkey[len];
+	val[len] = '\0';
+	return val;
+}
+
+/* reads attribute attr relative to the directory handle dirfd into buf,
+ * which has room for size bytes, and returns buf or NULL on error. The
+ * callers pass buffers on their stack, so refreshing devices does not
+ * allocate. dir is the path of the directory, it is only used to identify
+ * the file in traces */
+static char *
+get_acpi_content_at(const int dirfd, const char *dir, const char *attr, char *buf, const size_t size){
+	char path[MAX_NAME];
+	int fd, read_len = -1, served = SERVED_READ;
+	long long start = 0;
+
+	read_missed = 0;
+	if(trace_mode != TRACE_OFF){
+		snprintf(path, sizeof(path), "%s%s%s", dir ? dir : "", dir ? "/" : "", attr);
+		start = trace_now();
+	}
+	if(trace_mode == TRACE_REPLAY)
+		read_len = trace_read(path, buf, size - 1);
+	else if(in_refresh && backoff_skip(dir, attr))
 		return NULL;
-    }
-	read = fread(buf, 1, MAX_BUF, input);
-	if(read > 0) buf[read - 1] = '\0';
-	else buf[0] = '\0'; /* I would consider it a kernel bug if that happens */
+	else {
+		if((fd = openat(dirfd, attr, O_RDONLY | O_CLOEXEC)) >= 0)
+			read_len = deadline_read(fd, 0, dir, attr, buf, size - 1, &served);
+		read_missed = read_len == READ_MISSED;
+		/* a read which hangs counts against the file, one which got no
+		 * time says nothing about it */
+		if(in_refresh && served != SERVED_SKIPPED)
+			backoff_result(dir, attr, served == SERVED_READ && read_len >= 0);
+	}
+	if(trace_mode == TRACE_RECORD)
+		trace_log_read(path, buf, read_len, trace_now() - start);
 
-	fclose(input);
+	if(read_len < 0)
+		return NULL;
+	if(read_len > 0) buf[read_len - 1] = '\0';
+	else buf[0] = '\0'; /* I would consider it a kernel bug if that happens */
 	return buf;
 }
 
+/* starts the refresh of a device */
+static void
+refresh_begin(void){
+	in_refresh = 1;
+	deadline_begin();
+}
+
+/* ends the refresh of a device, returns ret or STALE */
+static int
+refresh_end(const int ret){
+	in_refresh = 0;
+	return deadline_end(ret);
+}
+
+/* reads a file into buf and returns buf, or NULL on error */
+static char *
+get_acpi_content(const char *file, char *buf, const size_t size){
+	return get_acpi_content_at(AT_FDCWD, NULL, file, buf, size);
+}
+
+/* register an extra attribute, returns its id or negative values on errors */
+int
+acpi_attr_register(const acpi_class_t dev_class, const char *name, const acpi_attr_type_t type,
+		const acpi_attr_refresh_t refresh, const char * const *values){
+	int i;
+
+	if(dev_class >= ACPI_CLASSES || !name || !name[0] || name[0] == '.' || strchr(name, '/'))
+		return NOT_SUPPORTED;
+	for(i = 0; i < attr_count; i++)
+		if(attrs[i].dev_class == dev_class && !strcmp(attrs[i].name, name))
+			return i;
+	if(attr_count == MAX_ATTRS)
+		return ITEM_EXCEED;
+	if((attrs[attr_count].name = intern("%s", name)) == NULL)
+		return ALLOC_ERR;
+	attrs[attr_count].dev_class = dev_class;
+	attrs[attr_count].type = type;
+	attrs[attr_count].refresh = refresh;
+	attrs[attr_count].values = values;
+	for(i = 0; i < MAX_ITEMS; i++){
+		attr_loaded[attr_count][i] = 0;
+		attr_values[attr_count][i].status = NOT_SUPPORTED;
+	}
+	return attr_count++;
+}
+
+/* forget all registered attributes */
+void
+acpi_attr_clear(void){
+	attr_count = 0;
+}
+
+/* copy the last value of attribute id of device num */
+int
+acpi_attr_get(const acpi_class_t dev_class, const int num, const int id, acpi_attr_value_t *value){
+	if(id < 0 || id >= attr_count || num < 0 || num >= MAX_ITEMS)
+		return ITEM_EXCEED;
+	if(attrs[id].dev_class != dev_class)
+		return NOT_SUPPORTED;
+	*value = attr_values[id][num];
+	return value->status;
+}
+
+/* mark the attributes of a newly found device as not read */
+static void
+reset_extra_attrs(const acpi_class_t dev_class, const int num){
+	int i;
+
+	for(i = 0; i < attr_count; i++)
+		if(attrs[i].dev_class == dev_class){
+			attr_loaded[i][num] = 0;
+			attr_values[i][num].status = NOT_SUPPORTED;
+		}
+}
+
+/* read the registered attributes of device num of a class through its
+ * directory handle, static ones only once after the device was found */
+static void
+read_extra_attrs(const acpi_class_t dev_class, const int num, const int dirfd, const char *dir){
+	char data[MAX_BUF + 1];
+	acpi_attr_value_t *v;
+	char *buf;
+	int i, j;
+
+	for(i = 0; i < attr_count; i++){
+		if(attrs[i].dev_class != dev_class || (attrs[i].refresh == ATTR_STATIC && attr_loaded[i][num]))
+			continue;
+		v = &attr_values[i][num];
+		attr_loaded[i][num] = 1;
+		if((buf = get_acpi_content_at(dirfd, dir, attrs[i].name, data, sizeof(data))) == NULL){
+			v->status = v->value = NOT_SUPPORTED;
+			v->string[0] = '\0';
+			continue;
+		}
+		v->status = SUCCESS;
+		snprintf(v->string, sizeof(v->string), "%s", buf);
+		if(attrs[i].type == ATTR_INT)
+			v->value = strtol(buf, NULL, 10);
+		else if(attrs[i].type == ATTR_ENUM){
+			v->value = NOT_SUPPORTED;
+			for(j = 0; attrs[i].values && attrs[i].values[j]; j++)
+				if(!strcmp(attrs[i].values[j], buf)){
+					v->value = j;
+					break;
+				}
+		} else
+			v->value = 0;
+	}
+}
+
+/* lists a directory, going through the trace backend if it is active */
+static list_t *
+acpi_dir_list(char *dir){
+	long long start;
+	list_t *lst;
+
+	if(trace_mode == TRACE_REPLAY)
+		return trace_dir_list(dir);
+	start = trace_mode == TRACE_RECORD ? trace_now() : 0;
+	lst = dir_list(dir);
+	if(trace_mode == TRACE_RECORD)
+		trace_log_dir(dir, lst, trace_now() - start);
+	return lst;
+}
+
+/* opens a handle for a device directory, attributes are read relative to it.
+ * The handle also pins the device for as long as it is open */
+static int
+open_acpi_dir(const char *dir){
+	return open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* input_fd of a device replayed from a trace, its input is read by name */
+#define INPUT_TRACE -3
+
+/* opens the input file attr of a hwmon channel or sysfs zone. A replayed
+ * trace has no files to open, the device gets INPUT_TRACE then */
+static int
+open_acpi_input(const int dirfd, const char *attr){
+	if(trace_mode == TRACE_REPLAY)
+		return attr ? INPUT_TRACE : -1;
+	return dirfd >= 0 && attr ? openat(dirfd, attr, O_RDONLY | O_CLOEXEC) : -1;
+}
+
+/* whether a device is read through its input file */
+static int
+has_acpi_input(const int fd){
+	return fd >= 0 || fd == INPUT_TRACE;
+}
+
+/* number of devices per class whose directory handles are open */
+static int open_batts, open_zones, open_fans, open_adapters, open_pcaps;
+
+/* close the directory handles of the first count devices of a class */
+static void
+close_acpi_dirs(void *devs, const size_t size, const size_t offset, int *count){
+	int i, *fd;
+
+	for(i = 0; i < *count; i++){
+		fd = (int *)((char *)devs + i * size + offset);
+		if(*fd >= 0) close(*fd);
+		*fd = -1;
+	}
+	*count = 0;
+}
+
+/* close the open input files of the first count devices of a class */
+static void
+close_acpi_inputs(void *devs, const size_t size, const size_t offset, const int count){
+	int n = count;
+
+	close_acpi_dirs(devs, size, offset, &n);
+}
+
+/* close the directory handles of all devices */
+void
+close_acpi(global_t *globals){
+	close_acpi_inputs(thermals, sizeof(thermal_t), offsetof(thermal_t, input_fd), open_zones);
+	close_acpi_inputs(fans, sizeof(fan_t), offsetof(fan_t, input_fd), open_fans);
+	close_acpi_dirs(batteries, sizeof(battery_t), offsetof(battery_t, dir_fd), &open_batts);
+	close_acpi_dirs(thermals, sizeof(thermal_t), offsetof(thermal_t, dir_fd), &open_zones);
+	close_acpi_dirs(fans, sizeof(fan_t), offsetof(fan_t, dir_fd), &open_fans);
+	close_acpi_dirs(adapters, sizeof(adapter_t), offsetof(adapter_t, dir_fd), &open_adapters);
+	close_acpi_dirs(powercaps, sizeof(powercap_t), offsetof(powercap_t, dir_fd), &open_pcaps);
+	globals->batt_count = globals->thermal_count = globals->fan_count = globals->adapt_count = 0;
+	globals->powercap_count = 0;
+	/* the directories may belong to other devices after the next discovery */
+	deadline_clear();
+}
+
 /* returns the acpi version or NOT_SUPPORTED(negative value) on failure */
 static int
 get_acpi_version(void){
+	char data[MAX_BUF + 1];
+	char value[LINE_MAX];
 	long ret = -1;
-	char *tmp = get_acpi_content(PROC_ACPI "info");
+	char *tmp = get_acpi_content(PROC_ACPI "info", data, sizeof(data));
 	char *version = NULL;
 	
 	if(!tmp) {
-		tmp = get_acpi_content("/sys/module/acpi/parameters/acpica_version");
+		tmp = get_acpi_content("/sys/module/acpi/parameters/acpica_version", data, sizeof(data));
 		if (tmp) {
 			long ret = strtol(tmp, NULL, 10);
-			free(tmp);
 			return ret;
 		} else {
 			return NOT_SUPPORTED;
 		}
 	}
-	if((version = scan_acpi_value(tmp, "version:")) == NULL){
-		free(tmp);
+	if((version = scan_acpi_value(tmp, "version:", value, sizeof(value))) == NULL){
 		return NOT_SUPPORTED;
 	}
 	ret = strtol(version, NULL, 10);
-	free(tmp);
-	free(version);
 	return ret;
 }
 
@@ -119,7 +426,7 @@ get_acpi_version(void){
  * and -1 if not */
 int
 check_acpi_support(void){
-	int version = get_acpi_version();
+	int version = cached_version ? cached_version : get_acpi_version();
 
 	/* we don't support 2.4 kernel versions TODO */
 	if(version == NOT_SUPPORTED || version < 20020214)
@@ -127,109 +434,254 @@ check_acpi_support(void){
 	return SUCCESS;
 }
 
+/* sort helper for directory names */
+static int
+cmp_names(const void *a, const void *b){
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* sort helper for names with numbers, hwmon2 goes before hwmon10 */
+static int
+cmp_versions(const void *a, const void *b){
+	return strverscmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* sort helper for integers */
+static int
+cmp_ints(const void *a, const void *b){
+	return *(const int *)a - *(const int *)b;
+}
+
+/* fill battery record num for the battery directory dir and read its static
+ * values, dirfd is an open handle for dir. Returns SUCCESS or ALLOC_ERR */
+static int
+setup_battery(const int num, const char *name, const char *dir, const int dirfd, const int sysstyle){
+	battery_t *binfo = &batteries[num];
+
+	binfo->name = intern("%s", name);
+	binfo->dir = dir;
+	binfo->dir_fd = dirfd;
+	open_batts = num + 1;
+	if(sysstyle) {
+		binfo->state_file = "status";
+		binfo->info_file = ".";
+	} else {
+		binfo->state_file = "state";
+		binfo->info_file = "info";
+	}
+	binfo->alarm_file = "alarm";
+	if(!binfo->name || !binfo->dir)
+		return ALLOC_ERR;
+	read_acpi_battinfo(num, sysstyle);
+	read_acpi_battalarm(binfo, sysstyle);
+	reset_extra_attrs(ACPI_CLASS_BATTERY, num);
+	gen_stamp(&binfo->gen, binfo->field_gen, G_BATT_GROUPS);
+	return SUCCESS;
+}
+
+/* fill adapter record num, dirfd is an open handle for dir */
+static int
+setup_adapter(const int num, const char *name, const char *dir, const int dirfd,
+		const char *state_file, const supply_type_t type){
+	adapter_t *ac = &adapters[num];
+
+	ac->name = intern("%s", name);
+	ac->dir = dir;
+	ac->dir_fd = dirfd;
+	ac->state_file = state_file;
+	ac->type = type;
+	open_adapters = num + 1;
+	if(!ac->name || !ac->dir)
+		return ALLOC_ERR;
+	reset_extra_attrs(ACPI_CLASS_AC, num);
+	gen_stamp(&ac->gen, ac->field_gen, G_AC_GROUPS);
+	return SUCCESS;
+}
+
+/* classify a power supply by the contents of its type attribute */
+static supply_type_t
+supply_type(const char *type, const char *name){
+	if(!type)
+		/* no type attribute, guess from the name */
+		return strncmp(name, "BAT", 3) ? S_UNKNOWN : S_BATTERY;
+	if(!strcmp(type, "Battery"))
+		return S_BATTERY;
+	if(!strcmp(type, "Mains"))
+		return S_MAINS;
+	if(!strncmp(type, "USB", 3))
+		return S_USB;
+	if(!strcmp(type, "UPS"))
+		return S_UPS;
+	return S_UNKNOWN;
+}
+
+/* classes init_sys_supplies() sets up */
+#define SUPPLY_BATT 1
+#define SUPPLY_AC 2
+
+/* lists SYS_POWER once and fills batteries[] and adapters[] from it, using
+ * the type attribute of every entry to classify it. Only the classes in
+ * want are touched, the others keep their devices. Batteries of peripheral
+ * devices (scope "Device") are skipped. Returns SUCCESS or NOT_SUPPORTED */
+static int
+init_sys_supplies(global_t *globals, const int want){
+	char data[MAX_BUF + 1];
+	char *names[MAX_ITEMS * 4];
+	const char *dir;
+	char *type, *scope;
+	list_t *lst = NULL;
+	node_t *node = NULL;
+	supply_type_t t;
+	int i, n = 0, fd, ret = SUCCESS;
+
+	if(want & SUPPLY_BATT){
+		close_acpi_dirs(batteries, sizeof(battery_t), offsetof(battery_t, dir_fd), &open_batts);
+		globals->batt_count = 0;
+	}
+	if(want & SUPPLY_AC){
+		close_acpi_dirs(adapters, sizeof(adapter_t), offsetof(adapter_t, dir_fd), &open_adapters);
+		globals->adapt_count = 0;
+	}
+
+	if((lst = acpi_dir_list(SYS_POWER)) == NULL || !lst->top) {
+		if(lst)
+			delete_list(lst);
+		return NOT_SUPPORTED;
+	}
+	for(node = lst->top; node && n < MAX_ITEMS * 4; node = node->next)
+		names[n++] = node->name;
+	qsort(names, n, sizeof(char *), cmp_names);
+
+	for(i = 0; i < n && ret == SUCCESS; i++){
+		if((dir = intern(SYS_POWER "/%s", names[i])) == NULL) {
+			ret = ALLOC_ERR;
+			break;
+		}
+		fd = open_acpi_dir(dir);
+		type = get_acpi_content_at(fd, dir, "type", data, sizeof(data));
+		t = supply_type(type, names[i]);
+
+		if(t == S_BATTERY && (scope = get_acpi_content_at(fd, dir, "scope", data, sizeof(data)))) {
+			if(!strcmp(scope, "Device"))
+				t = S_UNKNOWN;
+		}
+		if(t == S_BATTERY && (want & SUPPLY_BATT) && globals->batt_count < MAX_ITEMS)
+			ret = setup_battery(globals->batt_count++, names[i], dir, fd, 1);
+		else if(t != S_BATTERY && t != S_UNKNOWN && (want & SUPPLY_AC) &&
+				globals->adapt_count < MAX_ITEMS)
+			ret = setup_adapter(globals->adapt_count++, names[i], dir, fd, "online", t);
+		else if(fd >= 0)
+			close(fd);
+	}
+	delete_list(lst);
+	if(ret != SUCCESS) {
+		if(want & SUPPLY_BATT)
+			globals->batt_count = 0;
+		if(want & SUPPLY_AC)
+			globals->adapt_count = 0;
+		return ret;
+	}
+	globals->sysstyle = 1;
+	return SUCCESS;
+}
+
 /* reads existent battery directories and starts to fill the battery
  * structure. Returns 0 on success, negative values on error */
 int
 init_acpi_batt(global_t *globals){
 	char *names[MAX_ITEMS];
-	battery_t *binfo;
 	list_t *lst = NULL;
 	node_t *node = NULL;
-	int dir_count, num_bat, i = 0;
+	const char *dir;
+	int i = 0;
+	int ret = SUCCESS;
 
-	globals->batt_count = 0;
 	globals->sysstyle = 0;
-	if((lst = dir_list(PROC_ACPI "battery")) == NULL || !lst->top)
+	if((lst = acpi_dir_list(PROC_ACPI "battery")) == NULL || !lst->top)
 	{
         if (lst)
             delete_list(lst);
 		/* check for new Linux 2.6.24+ layout */
-		if((lst = dir_list(SYS_POWER)) == NULL || !lst->top)
-			return NOT_SUPPORTED;
-		else
-			globals->sysstyle = 1;
-	}
-	for(node = lst->top; node; node=node->next){
-		if((names[globals->batt_count] = strdup(node->name)) == NULL){
-			delete_list(lst);
-			return ALLOC_ERR;
-		}
-        globals->batt_count++;
+		if((ret = init_sys_supplies(globals, SUPPLY_BATT)) != SUCCESS)
+			return ret;
+		return globals->batt_count ? SUCCESS : NOT_SUPPORTED;
 	}
 
-	if(globals->batt_count > MAX_ITEMS) return ITEM_EXCEED;
-
-	/* A quick insertion sort, to sort battery names */
-	{
-		char *tmp1, *tmp2;
-		int x,y;
-		for (x = 1; x < globals->batt_count; x++) {
-			tmp1 = names[x];
-			y = x - 1;
-			while ((y >= 0) && ((strcmp (tmp1, names[y])) < 0)) {
-				tmp2 = names[y + 1];
-				names[y + 1] = names[y];
-				names[y] = tmp2;
-			}
-		}
-	}
+	close_acpi_dirs(batteries, sizeof(battery_t), offsetof(battery_t, dir_fd), &open_batts);
+	globals->batt_count = 0;
+	for(node = lst->top; node && globals->batt_count < MAX_ITEMS; node = node->next)
+		names[globals->batt_count++] = node->name;
+	qsort(names, globals->batt_count, sizeof(char *), cmp_names);
 
-    dir_count = globals->batt_count;
-
-    for (num_bat=i=0; i < dir_count && i < MAX_ITEMS; i++){
-        if (strncmp(names[i], "BAT", 3) == 0) {
-            binfo = &batteries[num_bat];
-            snprintf(binfo->name, MAX_NAME, "%s", names[i]);
-            if(globals->sysstyle) {
-                    snprintf(binfo->state_file, MAX_NAME, SYS_POWER "/%s/status", names[i]);
-                    snprintf(binfo->info_file, MAX_NAME, SYS_POWER "/%s", names[i]);
-                    snprintf(binfo->alarm_file, MAX_NAME, SYS_POWER "/%s/alarm", names[i]);
-            } else {
-                    snprintf(binfo->state_file, MAX_NAME, PROC_ACPI "battery/%s/state", names[i]);
-                    snprintf(binfo->info_file, MAX_NAME, PROC_ACPI "battery/%s/info", names[i]);
-                    snprintf(binfo->alarm_file, MAX_NAME, PROC_ACPI "battery/%s/alarm", names[i]);
-            }
-            read_acpi_battinfo(num_bat, globals->sysstyle);
-            read_acpi_battalarm(num_bat, globals->sysstyle);
-            num_bat++;
-        } else {
-            globals->batt_count--;
-        }
-		free(names[i]);
+	for(; i < globals->batt_count && ret == SUCCESS; i++){
+		if((dir = intern(PROC_ACPI "battery/%s", names[i])) == NULL)
+			ret = ALLOC_ERR;
+		else
+			ret = setup_battery(i, names[i], dir, open_acpi_dir(dir), 0);
 	}
 	delete_list(lst);
-	return SUCCESS;
+	if(ret != SUCCESS)
+		globals->batt_count = 0;
+	return ret;
 }
 
-/* reads the acpi state and writes it into the globals structure, void */
-void
-read_acpi_acstate(global_t *globals){
-	adapter_t *ac = &globals->adapt;
+/* reads the state of a single adapter, sysfs online files contain a number,
+ * proc state files a "state:" line */
+static void
+read_acpi_adapter(adapter_t *ac){
+	char data[MAX_BUF + 1];
+	char value[LINE_MAX];
+	power_state_t old = ac->ac_state;
 	char *buf = NULL;
 	char *tmp = NULL;
 
-	if(ac->state_file && (buf = get_acpi_content(ac->state_file)) == NULL){
+	read_extra_attrs(ACPI_CLASS_AC, ac - adapters, ac->dir_fd, ac->dir);
+	if((buf = get_acpi_content_at(ac->dir_fd, ac->dir, ac->state_file, data, sizeof(data))) == NULL)
 		ac->ac_state = P_ERR;
-		return;
-	}
-	if(globals->sysstyle)
-	{
-		if(!strcmp(buf, "1"))
-			ac->ac_state = P_AC;
-		else if(!strcmp(buf, "0"))
-			ac->ac_state = P_BATT;
-		else ac->ac_state = P_ERR;
-	}
-	else
-	{
-		if((tmp = scan_acpi_value(buf, "state:")) && !strncmp(tmp, "on-line", 7))
-			ac->ac_state = P_AC;
-		else if(tmp && !strncmp(tmp, "off-line", 8))
-			ac->ac_state = P_BATT;
-		else ac->ac_state = P_ERR;
+	else if(isdigit((unsigned char)buf[0]))
+		/* USB sources report 2 when online with a non default current */
+		ac->ac_state = strtol(buf, NULL, 10) ? P_AC : P_BATT;
+	else if((tmp = scan_acpi_value(buf, "state:", value, sizeof(value))) && !strncmp(tmp, "on-line", 7))
+		ac->ac_state = P_AC;
+	else if(tmp && !strncmp(tmp, "off-line", 8))
+		ac->ac_state = P_BATT;
+	else ac->ac_state = P_ERR;
+	gen_bump(&ac->gen, &ac->field_gen[G_AC_STATE], old != ac->ac_state);
+}
+
+/* reads the state of all adapters and writes the combined state into the
+ * globals structure: on-line if any source is on-line, void */
+void
+read_acpi_acstate(global_t *globals){
+	adapter_t *ac = &globals->adapt;
+	power_state_t old = ac->ac_state;
+	int i;
+
+	refresh_begin();
+	ac->ac_state = P_ERR;
+	for(i = 0; i < globals->adapt_count; i++){
+		read_acpi_adapter(&adapters[i]);
+		if(adapters[i].ac_state == P_AC || ac->ac_state == P_ERR)
+			ac->ac_state = adapters[i].ac_state == P_AC ? P_AC :
+				adapters[i].ac_state == P_BATT ? P_BATT : ac->ac_state;
 	}
-	free(buf);
-	free(tmp);
+	gen_bump(&ac->gen, &ac->field_gen[G_AC_STATE], old != ac->ac_state);
+	refresh_end(SUCCESS);
+}
+
+/* the global adapter describes the first source and holds the combined
+ * state of all of them, it has no handle of its own */
+static void
+setup_global_adapter(global_t *globals){
+	adapter_t *ac = &globals->adapt;
+
+	ac->name = adapters[0].name;
+	ac->dir = adapters[0].dir;
+	ac->dir_fd = -1;
+	ac->state_file = adapters[0].state_file;
+	ac->type = adapters[0].type;
+	read_acpi_acstate(globals);
+	gen_stamp(&ac->gen, ac->field_gen, G_AC_GROUPS);
 }
 
 /* reads the name of the ac-adapter directory and fills the adapter_t
@@ -237,235 +689,1056 @@ read_acpi_acstate(global_t *globals){
 int
 init_acpi_acadapt(global_t *globals){
 	list_t *lst = NULL;
-	adapter_t *ac = &globals->adapt;
+	const char *dir;
+	int ret;
 
 	globals->sysstyle = 0;
-	if((lst = dir_list(PROC_ACPI "ac_adapter")) == NULL || !lst->top)
+	if((lst = acpi_dir_list(PROC_ACPI "ac_adapter")) == NULL || !lst->top)
 	{
-		if((lst = dir_list(SYS_POWER "/AC")) == NULL || !lst->top)
+		if(lst)
+			delete_list(lst);
+		if((ret = init_sys_supplies(globals, SUPPLY_AC)) != SUCCESS)
+			return ret;
+		if(!globals->adapt_count)
 			return NOT_SUPPORTED;
-		else
-			globals->sysstyle = 1;
-	}
-	if((!lst->top->name || ((ac->name = strdup(lst->top->name)) == NULL))){
+	} else {
+		close_acpi_dirs(adapters, sizeof(adapter_t), offsetof(adapter_t, dir_fd), &open_adapters);
+		globals->adapt_count = 0;
+		dir = intern(PROC_ACPI "ac_adapter/%s", lst->top->name);
+		ret = dir ? setup_adapter(0, lst->top->name, dir, open_acpi_dir(dir), "state", S_MAINS) : ALLOC_ERR;
 		delete_list(lst);
-		return ALLOC_ERR;
+		if(ret != SUCCESS)
+			return ret;
+		globals->adapt_count = 1;
 	}
-	if(globals->sysstyle)
-		snprintf(ac->state_file, MAX_NAME, SYS_POWER "/AC/online");
-	else
-		snprintf(ac->state_file, MAX_NAME, PROC_ACPI "ac_adapter/%s/state", ac->name);
-	delete_list(lst);
-	read_acpi_acstate(globals);
+
+	setup_global_adapter(globals);
 	return SUCCESS;
 }
 
+/* classifies every power supply once and fills batteries, adapters and the
+ * combined adapter state. Return 0 on success, negative values on errors */
+int
+init_acpi_supplies(global_t *globals){
+	int batt, ac;
+
+	if(init_sys_supplies(globals, SUPPLY_BATT | SUPPLY_AC) != SUCCESS) {
+		/* fall back to the old /proc layout */
+		batt = init_acpi_batt(globals);
+		ac = init_acpi_acadapt(globals);
+		return batt == SUCCESS || ac == SUCCESS ? SUCCESS : NOT_SUPPORTED;
+	}
+	if(globals->adapt_count)
+		setup_global_adapter(globals);
+	return globals->batt_count || globals->adapt_count ? SUCCESS : NOT_SUPPORTED;
+}
+
+/* reads an integer attribute of a hwmon channel through its open input
+ * file. While a trace is recorded or replayed the attribute is read by
+ * name instead, so it shows up in the trace. Returns SUCCESS or NOT_SUPPORTED */
+static int
+read_hwmon_value(const int fd, const int dirfd, const char *dir, const char *attr, int *value){
+	char data[MAX_BUF + 1];
+	char buf[32];
+	char *tmp;
+	int n, served;
+
+	if(trace_mode != TRACE_OFF){
+		if((tmp = get_acpi_content_at(dirfd, dir, attr, data, sizeof(data))) == NULL)
+			return NOT_SUPPORTED;
+		*value = strtol(tmp, NULL, 10);
+		return SUCCESS;
+	}
+	if(in_refresh && backoff_skip(dir, attr))
+		return NOT_SUPPORTED;
+	n = deadline_read(fd, 1, dir, attr, buf, sizeof(buf) - 1, &served);
+	if(in_refresh && served != SERVED_SKIPPED)
+		backoff_result(dir, attr, served == SERVED_READ && n > 0);
+	if(n <= 0)
+		return NOT_SUPPORTED;
+	buf[n] = '\0';
+	*value = strtol(buf, NULL, 10);
+	return SUCCESS;
+}
+
+/* refresh the speed of a hwmon fan, a fan standing still is off */
+static int
+read_hwmon_fan(fan_t *info){
+	fan_t old = *info;
+	int ret;
+
+	if((ret = read_hwmon_value(info->input_fd, info->dir_fd, info->dir, info->state_file,
+			&info->rpm)) != SUCCESS)
+		info->rpm = NOT_SUPPORTED;
+	info->fan_state = info->rpm > 0 ? F_ON : info->rpm == 0 ? F_OFF : F_ERR;
+	gen_bump(&info->gen, &info->field_gen[G_FAN_STATE], old.fan_state != info->fan_state);
+	gen_bump(&info->gen, &info->field_gen[G_FAN_SPEED], old.rpm != info->rpm);
+	return ret;
+}
+
 /* read acpi information for fan num, returns 0 on success and negative values on errors */
 int
 read_acpi_fan(const int num){
+	char data[MAX_BUF + 1];
+	char value[LINE_MAX];
+	char *buf = NULL;
+	char *tmp = NULL;
+	fan_t *info;
+	fan_state_t old;
+
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	info = &fans[num];
+	old = info->fan_state;
+	refresh_begin();
+	read_extra_attrs(ACPI_CLASS_FAN, num, info->dir_fd, info->dir);
+	if(has_acpi_input(info->input_fd))
+		return refresh_end(read_hwmon_fan(info));
+
+	/* scan state file */
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->state_file, data, sizeof(data))) == NULL)
+		info->fan_state = F_ERR;
+
+	if(!buf || (tmp = scan_acpi_value(buf, "status:", value, sizeof(value))) == NULL){
+		info->fan_state = F_ERR;
+		gen_bump(&info->gen, &info->field_gen[G_FAN_STATE], old != info->fan_state);
+		return refresh_end(NOT_SUPPORTED);
+	}
+	if (tmp[0] == 'o' && tmp[1] == 'n') info->fan_state = F_ON;
+	else if(tmp[0] == 'o' && tmp[1] == 'f') info->fan_state = F_OFF;
+	else info->fan_state = F_ERR;
+	gen_bump(&info->gen, &info->field_gen[G_FAN_STATE], old != info->fan_state);
+	return refresh_end(SUCCESS);
+}
+
+/* read all fans, fill the fan structures */
+static void
+read_acpi_fans(global_t *globals){
+	int i;
+	for(i = 0; i < globals->fan_count; i++)
+		read_acpi_fan(i);
+}
+
+/* reads the names of the fan directories, fills fan_t,
+ * return 0 on success, negative values on errors */
+int
+init_acpi_fan(global_t *globals){
+	char *names[MAX_ITEMS];
+	list_t *lst = NULL;
+	node_t *node = NULL;
+	int i = 0;
+	int ret = SUCCESS;
+	fan_t *finfo = NULL;
+
+	close_acpi_inputs(fans, sizeof(fan_t), offsetof(fan_t, input_fd), open_fans);
+	close_acpi_dirs(fans, sizeof(fan_t), offsetof(fan_t, dir_fd), &open_fans);
+	globals->fan_count = 0;
+
+	if((lst = acpi_dir_list(PROC_ACPI "fan")) == NULL || !lst->top){
+		if(lst)
+			delete_list(lst);
+		return NOT_SUPPORTED;
+	}
+	for(node = lst->top; node && globals->fan_count < MAX_ITEMS; node = node->next)
+		names[globals->fan_count++] = node->name;
+
+	for (; i < globals->fan_count; i++){
+		finfo = &fans[i];
+		finfo->name = intern("%s", names[i]);
+		finfo->dir = intern(PROC_ACPI "fan/%s", names[i]);
+		finfo->state_file = "state";
+		finfo->chip = finfo->label = NULL;
+		finfo->rpm = NOT_SUPPORTED;
+		if(!finfo->name || !finfo->dir)
+			ret = ALLOC_ERR;
+		finfo->dir_fd = finfo->dir ? open_acpi_dir(finfo->dir) : -1;
+		finfo->input_fd = -1;
+		open_fans = i + 1;
+		reset_extra_attrs(ACPI_CLASS_FAN, i);
+		gen_stamp(&finfo->gen, finfo->field_gen, G_FAN_GROUPS);
+	}
+	delete_list(lst);
+	if(ret != SUCCESS){
+		globals->fan_count = 0;
+		return ret;
+	}
+	read_acpi_fans(globals);
+	return SUCCESS;
+}
+
+/* kind of a trip point from its name in trip_points or trip_point_N_type,
+ * T_ERR if unknown */
+static thermal_state_t
+trip_type(const char *name){
+	if(!strncmp(name, "crit", 4))
+		return T_CRIT;
+	if(!strncmp(name, "hot", 3))
+		return T_HOT;
+	if(!strncmp(name, "pas", 3))
+		return T_PASS;
+	if(!strncmp(name, "act", 3))
+		return T_ACT;
+	return T_ERR;
+}
+
+/* add a trip point to a zone, unknown kinds are ignored */
+static void
+add_trip(thermal_t *info, const thermal_state_t type, const int temperature){
+	if(type == T_ERR || info->trip_count >= MAX_TRIPS)
+		return;
+	info->trips[info->trip_count].type = type;
+	info->trips[info->trip_count].temperature = temperature;
+	info->trip_count++;
+}
+
+/* parse the trip_points file of a /proc zone, its lines look like
+ * "critical (S5):  105 C" or "active[0]:  70 C: devices=FAN0" */
+static void
+read_acpi_trips(thermal_t *info){
+	char data[MAX_BUF + 1];
+	char *line, *next, *val;
+
+	info->trip_count = 0;
+	if(get_acpi_content_at(info->dir_fd, info->dir, info->trips_file, data, sizeof(data)) == NULL)
+		return;
+	for(line = data; line; line = next){
+		if((next = strchr(line, '\n')))
+			*next++ = '\0';
+		if((val = strchr(line, ':')))
+			add_trip(info, trip_type(line), strtol(val + 1, NULL, 10));
+	}
+}
+
+/* read the trip points of a sysfs zone, the temperatures are in
+ * millidegrees. Disabled trip points read 0 or below and are skipped */
+static void
+read_sys_trips(thermal_t *info){
+	char data[MAX_BUF + 1];
+	char attr[32];
+	char *buf;
+	thermal_state_t type;
+	int i, temp;
+
+	info->trip_count = 0;
+	for(i = 0; info->trip_count < MAX_TRIPS; i++){
+		snprintf(attr, sizeof(attr), "trip_point_%d_type", i);
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, attr, data, sizeof(data))) == NULL)
+			break;
+		type = trip_type(buf);
+		snprintf(attr, sizeof(attr), "trip_point_%d_temp", i);
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, attr, data, sizeof(data))) == NULL)
+			continue;
+		if((temp = strtol(buf, NULL, 10)) > 0)
+			add_trip(info, type, temp / 1000);
+	}
+}
+
+/* fills thermals[] from the thermal_zone entries of SYS_THERMAL. The type
+ * attribute becomes the label, the temperature file stays open and is read
+ * like a hwmon sensor. Returns SUCCESS or negative values on errors */
+static int
+init_sys_thermal(global_t *globals){
+	char data[MAX_BUF + 1];
+	char *names[MAX_ITEMS * 2];
+	list_t *lst = NULL;
+	node_t *node = NULL;
+	thermal_t *tinfo = NULL;
+	char *type;
+	int i, n = 0;
+	int ret = SUCCESS;
+
+	if((lst = acpi_dir_list(SYS_THERMAL)) == NULL)
+		return NOT_SUPPORTED;
+	/* the cooling devices live next to the zones */
+	for(node = lst->top; node && n < MAX_ITEMS * 2; node = node->next)
+		if(!strncmp(node->name, "thermal_zone", 12))
+			names[n++] = node->name;
+	qsort(names, n, sizeof(char *), cmp_versions);
+
+	for(i = 0; i < n && globals->thermal_count < MAX_ITEMS; i++){
+		tinfo = &thermals[globals->thermal_count];
+		tinfo->name = intern("%s", names[i]);
+		tinfo->dir = intern(SYS_THERMAL "/%s", names[i]);
+		tinfo->dir_fd = tinfo->dir ? open_acpi_dir(tinfo->dir) : -1;
+		type = get_acpi_content_at(tinfo->dir_fd, tinfo->dir, "type", data, sizeof(data));
+		tinfo->label = type ? intern("%s", type) : NULL;
+		tinfo->chip = NULL;
+		tinfo->temp_file = "temp";
+		tinfo->state_file = tinfo->cooling_file = tinfo->freq_file = tinfo->trips_file = NULL;
+		tinfo->crit = tinfo->max = NOT_SUPPORTED;
+		tinfo->therm_mode = CO_ERR;
+		tinfo->frequency = DISABLED;
+		tinfo->input_fd = open_acpi_input(tinfo->dir_fd, tinfo->temp_file);
+		memset(tinfo->cpus, 0, sizeof(tinfo->cpus));
+		read_sys_trips(tinfo);
+		open_zones = ++globals->thermal_count;
+		if(!tinfo->name || !tinfo->dir){
+			ret = ALLOC_ERR;
+			break;
+		}
+		forecast_reset(tinfo - thermals);
+		reset_extra_attrs(ACPI_CLASS_ZONE, tinfo - thermals);
+		gen_stamp(&tinfo->gen, tinfo->field_gen, G_ZONE_GROUPS);
+	}
+	delete_list(lst);
+	if(ret != SUCCESS){
+		globals->thermal_count = 0;
+		return ret;
+	}
+	if(!globals->thermal_count)
+		return NOT_SUPPORTED;
+	read_acpi_thermalzones(globals);
+	return SUCCESS;
+}
+
+/* reads the name of the thermal-zone directory and fills the adapter_t
+ * structure with the name and the state-file. Return 0 on success, negative values on errors */
+int
+init_acpi_thermal(global_t *globals){
+	char *names[MAX_ITEMS];
+	list_t *lst = NULL;
+	node_t *node = NULL;
+	thermal_t *tinfo = NULL;
+	int i = 0;
+	int ret = SUCCESS;
+
+	close_acpi_inputs(thermals, sizeof(thermal_t), offsetof(thermal_t, input_fd), open_zones);
+	close_acpi_dirs(thermals, sizeof(thermal_t), offsetof(thermal_t, dir_fd), &open_zones);
+	globals->thermal_count = 0;
+
+	if((lst = acpi_dir_list(PROC_ACPI "thermal_zone")) == NULL)
+		return init_sys_thermal(globals);
+	for(node = lst->top; node && globals->thermal_count < MAX_ITEMS; node = node->next)
+		names[globals->thermal_count++] = node->name;
+
+	for (; i < globals->thermal_count; i++){
+		tinfo = &thermals[i];
+		tinfo->name = intern("%s", names[i]);
+		tinfo->dir = intern(PROC_ACPI "thermal_zone/%s", names[i]);
+		tinfo->state_file = "state";
+		tinfo->temp_file = "temperature";
+		tinfo->cooling_file = "cooling_mode";
+		tinfo->freq_file = "polling_frequency";
+		tinfo->trips_file = "trip_points";
+		tinfo->chip = tinfo->label = NULL;
+		tinfo->crit = tinfo->max = NOT_SUPPORTED;
+		memset(tinfo->cpus, 0, sizeof(tinfo->cpus));
+		if(!tinfo->name || !tinfo->dir)
+			ret = ALLOC_ERR;
+		tinfo->dir_fd = tinfo->dir ? open_acpi_dir(tinfo->dir) : -1;
+		tinfo->input_fd = -1;
+		read_acpi_trips(tinfo);
+		open_zones = i + 1;
+		forecast_reset(tinfo - thermals);
+		reset_extra_attrs(ACPI_CLASS_ZONE, tinfo - thermals);
+		gen_stamp(&tinfo->gen, tinfo->field_gen, G_ZONE_GROUPS);
+	}
+	delete_list(lst);
+	if(ret != SUCCESS){
+		globals->thermal_count = 0;
+		return ret;
+	}
+	read_acpi_thermalzones(globals);
+	return SUCCESS;
+}
+
+/* checks the string state and sets the thermal state, returns void */
+static void
+thermal_state(const char *state, thermal_t *info){
+	if(state[0] == 'o')
+		info->therm_state = T_OK;
+	else if(!strncmp (state, "crit", 4))
+		info->therm_state = T_CRIT;
+	else if (!strncmp (state, "hot", 3))
+		info->therm_state = T_HOT; else if (!strncmp (state, "pas", 3))
+		info->therm_state = T_PASS;
+	else
+		info->therm_state = T_ACT;
+}
+
+/* checks the string tmp and sets the cooling mode */
+static void
+fill_cooling_mode(const char *tmp, thermal_t *info){
+	if(tmp[0] == 'a')
+		info->therm_mode = CO_ACT;
+	else if(tmp[0]  == 'p')
+		info->therm_mode = CO_PASS;
+	else info->therm_mode = CO_CRIT;
+}
+
+/* the most severe trip point a zone has reached, T_OK if none */
+static thermal_state_t
+trip_state(const thermal_t *info){
+	thermal_state_t state = T_OK;
+	int i;
+
+	for(i = 0; i < info->trip_count; i++)
+		if(info->temperature >= info->trips[i].temperature && info->trips[i].type < state)
+			state = info->trips[i].type;
+	return state;
+}
+
+/* refresh the temperature of a hwmon sensor or sysfs zone through its open
+ * input file, the state follows from the trip points */
+static int
+read_input_zone(const int num, thermal_t *info, global_t *globals){
+	thermal_t old = *info;
+	int ret, temp;
+
+	if((ret = read_hwmon_value(info->input_fd, info->dir_fd, info->dir, info->temp_file,
+			&temp)) == SUCCESS) {
+		/* millidegrees */
+		info->temperature = temp / 1000;
+		forecast_add(num, trace_now(), temp);
+		info->therm_state = trip_state(info);
+		if(globals && globals->thermal_count == 1)
+			globals->temperature = info->temperature;
+	} else {
+		info->temperature = NOT_SUPPORTED;
+		info->therm_state = T_ERR;
+	}
+	gen_bump(&info->gen, &info->field_gen[G_ZONE_TEMP], old.temperature != info->temperature);
+	gen_bump(&info->gen, &info->field_gen[G_ZONE_STATE], old.therm_state != info->therm_state);
+	return ret;
+}
+
+/* refresh the values of thermal zone num in info, called between
+ * refresh_begin() and refresh_end(). globals is NULL for a copy of the
+ * zone, the global temperature is left alone then */
+static int
+zone_refresh(const int num, thermal_t *info, global_t *globals){
+	char data[MAX_BUF + 1];
+	char value[LINE_MAX];
 	char *buf = NULL;
 	char *tmp = NULL;
-	fan_t *info = &fans[num];
+	thermal_t old = *info;
 
-	if(num > MAX_ITEMS) return ITEM_EXCEED;
+	if(has_acpi_input(info->input_fd))
+		return read_input_zone(num, info, globals);
+
+	/* scan state file */
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->state_file, data, sizeof(data))) == NULL)
+		info->therm_state = T_ERR;
+
+	if(buf && (tmp = scan_acpi_value(buf, "state:", value, sizeof(value))))
+			thermal_state(tmp, info);
+
+	/* scan temperature file */
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->temp_file, data, sizeof(data))) == NULL)
+		info->temperature = NOT_SUPPORTED;
+
+	if(buf && (tmp = scan_acpi_value(buf, "temperature:", value, sizeof(value)))){
+		info->temperature = strtol(tmp, NULL, 10);
+		forecast_add(num, trace_now(), info->temperature * 1000);
+		/* if we just have one big thermal zone, this will be the global temperature */
+		if(globals && globals->thermal_count == 1)
+			globals->temperature = info->temperature;
+	}
+
+	/* scan cooling mode file */
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->cooling_file, data, sizeof(data))) == NULL)
+		info->therm_mode = CO_ERR;
+	if(buf && (tmp = scan_acpi_value(buf, "cooling mode:", value, sizeof(value))))
+		fill_cooling_mode(tmp, info);
+	else info->therm_mode = CO_ERR;
+
+	/* scan polling_frequencies file */
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->freq_file, data, sizeof(data))) == NULL)
+		info->frequency = DISABLED;
+	if(buf && (tmp = scan_acpi_value(buf, "polling frequency:", value, sizeof(value))))
+		info->frequency = strtol(tmp, NULL, 10);
+	else info->frequency = DISABLED;
+
+	gen_bump(&info->gen, &info->field_gen[G_ZONE_TEMP], old.temperature != info->temperature);
+	gen_bump(&info->gen, &info->field_gen[G_ZONE_STATE], old.therm_state != info->therm_state);
+	gen_bump(&info->gen, &info->field_gen[G_ZONE_MODE], old.therm_mode != info->therm_mode);
+	gen_bump(&info->gen, &info->field_gen[G_ZONE_FREQ], old.frequency != info->frequency);
+	return SUCCESS;
+}
+
+/* reads values for thermal_zone num, return 0 on success, negative values on error */
+int
+read_acpi_zone(const int num, global_t *globals){
+	thermal_t *info;
+
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	info = &thermals[num];
+	refresh_begin();
+	read_extra_attrs(ACPI_CLASS_ZONE, num, info->dir_fd, info->dir);
+	return refresh_end(zone_refresh(num, info, globals));
+}
+
+/* refresh a copy of thermal zone num, thermals[] is not touched */
+int
+read_acpi_zone_copy(const int num, thermal_t *info){
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	refresh_begin();
+	return refresh_end(zone_refresh(num, info, NULL));
+}
+
+/* read all thermal zones, fill the thermal structures */
+static void
+read_acpi_thermalzones(global_t *globals){
+	int i;
+	for(i = 0; i < globals->thermal_count; i++)
+		read_acpi_zone(i, globals);
+}
+
+/* reads a hwmon threshold in millidegrees and returns it in degrees,
+ * NOT_SUPPORTED if the chip has none */
+static int
+hwmon_threshold(const int dirfd, const char *dir, const char *fmt, const int ch){
+	char data[MAX_BUF + 1];
+	char attr[32];
+	char *buf;
+	int value;
+
+	snprintf(attr, sizeof(attr), fmt, ch);
+	if((buf = get_acpi_content_at(dirfd, dir, attr, data, sizeof(data))) == NULL)
+		return NOT_SUPPORTED;
+	value = strtol(buf, NULL, 10) / 1000;
+	return value;
+}
+
+/* reads the label of a hwmon channel, NULL if it has none */
+static const char *
+hwmon_label(const int dirfd, const char *dir, const char *fmt, const int ch){
+	char data[MAX_BUF + 1];
+	char attr[32];
+	char *buf;
+	const char *label;
+
+	snprintf(attr, sizeof(attr), fmt, ch);
+	if((buf = get_acpi_content_at(dirfd, dir, attr, data, sizeof(data))) == NULL)
+		return NULL;
+	label = intern("%s", buf);
+	return label;
+}
+
+/* append temperature channel ch of a hwmon chip to the thermal zones */
+static int
+add_hwmon_zone(global_t *globals, const char *entry, const char *chip,
+		const char *dir, const int dirfd, const int ch){
+	thermal_t *info;
+
+	if(globals->thermal_count >= MAX_ITEMS)
+		return ITEM_EXCEED;
+	info = &thermals[globals->thermal_count];
+	info->name = intern("%s/temp%d", entry, ch);
+	info->chip = chip;
+	info->label = hwmon_label(dirfd, dir, "temp%d_label", ch);
+	info->dir = dir;
+	info->temp_file = intern("temp%d_input", ch);
+	info->state_file = info->cooling_file = info->freq_file = info->trips_file = NULL;
+	info->crit = hwmon_threshold(dirfd, dir, "temp%d_crit", ch);
+	info->max = hwmon_threshold(dirfd, dir, "temp%d_max", ch);
+	info->trip_count = 0;
+	if(info->max != NOT_SUPPORTED)
+		add_trip(info, T_HOT, info->max);
+	if(info->crit != NOT_SUPPORTED)
+		add_trip(info, T_CRIT, info->crit);
+	memset(info->cpus, 0, sizeof(info->cpus));
+	info->therm_mode = CO_ERR;
+	info->frequency = DISABLED;
+	info->dir_fd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+	info->input_fd = open_acpi_input(dirfd, info->temp_file);
+	open_zones = ++globals->thermal_count;
+	if(!info->name || !info->temp_file)
+		return ALLOC_ERR;
+	forecast_reset(info - thermals);
+	reset_extra_attrs(ACPI_CLASS_ZONE, info - thermals);
+	gen_stamp(&info->gen, info->field_gen, G_ZONE_GROUPS);
+	return SUCCESS;
+}
+
+/* append fan channel ch of a hwmon chip to the fans */
+static int
+add_hwmon_fan(global_t *globals, const char *entry, const char *chip,
+		const char *dir, const int dirfd, const int ch){
+	fan_t *info;
+
+	if(globals->fan_count >= MAX_ITEMS)
+		return ITEM_EXCEED;
+	info = &fans[globals->fan_count];
+	info->name = intern("%s/fan%d", entry, ch);
+	info->chip = chip;
+	info->label = hwmon_label(dirfd, dir, "fan%d_label", ch);
+	info->dir = dir;
+	info->state_file = intern("fan%d_input", ch);
+	info->dir_fd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+	info->input_fd = open_acpi_input(dirfd, info->state_file);
+	open_fans = ++globals->fan_count;
+	if(!info->name || !info->state_file)
+		return ALLOC_ERR;
+	reset_extra_attrs(ACPI_CLASS_FAN, info - fans);
+	gen_stamp(&info->gen, info->field_gen, G_FAN_GROUPS);
+	return SUCCESS;
+}
+
+/* adds the temperature and fan channels of one hwmon chip, entry is the
+ * name of its directory below root */
+static int
+init_hwmon_chip(global_t *globals, const char *root, const char *entry){
+	char data[MAX_BUF + 1];
+	char *attrs[MAX_ITEMS * 4];
+	char path[MAX_NAME];
+	list_t *lst = NULL;
+	node_t *node = NULL;
+	const char *dir, *chip;
+	char *buf;
+	int i, n = 0, fd, ch, ret = SUCCESS;
+
+	if((dir = intern("%s/%s", root, entry)) == NULL)
+		return ALLOC_ERR;
+	fd = open_acpi_dir(dir);
+	if((buf = get_acpi_content_at(fd, dir, "name", data, sizeof(data))) == NULL) {
+		/* older drivers keep the attributes in the device directory */
+		if(fd >= 0) close(fd);
+		if((dir = intern("%s/%s/device", root, entry)) == NULL)
+			return ALLOC_ERR;
+		fd = open_acpi_dir(dir);
+		buf = get_acpi_content_at(fd, dir, "name", data, sizeof(data));
+	}
+	/* a replayed trace has the attributes but no directory to open */
+	if(!buf || (fd < 0 && trace_mode != TRACE_REPLAY)) {
+		if(fd >= 0) close(fd);
+		return NOT_SUPPORTED;
+	}
+	chip = intern("%s", buf);
+
+	snprintf(path, sizeof(path), "%s", dir);
+	if((lst = acpi_dir_list(path)) == NULL) {
+		if(fd >= 0) close(fd);
+		return NOT_SUPPORTED;
+	}
+	for(node = lst->top; node && n < MAX_ITEMS * 4; node = node->next)
+		if(strstr(node->name, "_input"))
+			attrs[n++] = node->name;
+	qsort(attrs, n, sizeof(char *), cmp_versions);
+
+	for(i = 0; i < n && ret == SUCCESS; i++){
+		if(sscanf(attrs[i], "temp%d_input", &ch) == 1)
+			ret = add_hwmon_zone(globals, entry, chip, dir, fd, ch);
+		else if(sscanf(attrs[i], "fan%d_input", &ch) == 1)
+			ret = add_hwmon_fan(globals, entry, chip, dir, fd, ch);
+	}
+	delete_list(lst);
+	if(fd >= 0) close(fd);
+	return ret;
+}
+
+/* appends the channels of all hwmon chips below root to the thermal zones
+ * and fans. Return 0 on success, negative values on errors */
+int
+init_acpi_hwmon(global_t *globals, const char *root){
+	char *names[MAX_ITEMS];
+	char path[MAX_NAME];
+	list_t *lst = NULL;
+	node_t *node = NULL;
+	int i, n = 0, first_zone = globals->thermal_count, first_fan = globals->fan_count;
+	int ret = SUCCESS;
+
+	snprintf(path, sizeof(path), "%s", root ? root : SYS_HWMON);
+	if((lst = acpi_dir_list(path)) == NULL)
+		return NOT_SUPPORTED;
+	for(node = lst->top; node && n < MAX_ITEMS; node = node->next)
+		names[n++] = node->name;
+	qsort(names, n, sizeof(char *), cmp_versions);
+
+	for(i = 0; i < n && ret != ALLOC_ERR && ret != ITEM_EXCEED; i++)
+		ret = init_hwmon_chip(globals, path, names[i]);
+	delete_list(lst);
+	if(ret == ALLOC_ERR)
+		return ret;
+
+	for(i = first_zone; i < globals->thermal_count; i++)
+		read_acpi_zone(i, globals);
+	for(i = first_fan; i < globals->fan_count; i++)
+		read_acpi_fan(i);
+	return globals->thermal_count > first_zone || globals->fan_count > first_fan ?
+		SUCCESS : NOT_SUPPORTED;
+}
+
+/* reads the package and core id of every online CPU below root, both are
+ * -1 for CPUs that are missing or offline. Returns the number of CPUs found */
+static int
+read_cpu_topology(const char *root, int *pkg, int *core){
+	char data[MAX_BUF + 1];
+	char path[MAX_NAME];
+	list_t *lst = NULL;
+	node_t *node = NULL;
+	char *buf;
+	int cpu, n = 0;
+
+	for(cpu = 0; cpu < MAX_CPUS; cpu++)
+		pkg[cpu] = core[cpu] = -1;
+	snprintf(path, sizeof(path), "%s", root);
+	if((lst = acpi_dir_list(path)) == NULL)
+		return 0;
+	for(node = lst->top; node; node = node->next){
+		/* skips cpufreq, cpuidle and friends as well */
+		if(sscanf(node->name, "cpu%d", &cpu) != 1 || cpu < 0 || cpu >= MAX_CPUS)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/online", root, node->name);
+		if((buf = get_acpi_content(path, data, sizeof(data))) && buf[0] == '0')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/topology/physical_package_id", root, node->name);
+		if((buf = get_acpi_content(path, data, sizeof(data))) == NULL)
+			continue;
+		pkg[cpu] = strtol(buf, NULL, 10);
+		snprintf(path, sizeof(path), "%s/%s/topology/core_id", root, node->name);
+		if((buf = get_acpi_content(path, data, sizeof(data))) == NULL) {
+			pkg[cpu] = -1;
+			continue;
+		}
+		core[cpu] = strtol(buf, NULL, 10);
+		n++;
+	}
+	delete_list(lst);
+	return n;
+}
+
+/* add the CPUs of a package to a zone, only the ones with core id
+ * core_id unless it is -1. Returns the number of added CPUs */
+static int
+map_zone_cpus(thermal_t *info, const int *pkg, const int *core, const int package,
+		const int core_id){
+	int cpu, n = 0;
+
+	for(cpu = 0; cpu < MAX_CPUS; cpu++)
+		if(pkg[cpu] >= 0 && pkg[cpu] == package && (core_id < 0 || core[cpu] == core_id)){
+			info->cpus[cpu / LONG_BITS] |= 1UL << cpu % LONG_BITS;
+			n++;
+		}
+	return n;
+}
+
+/* the package a coretemp chip reports on, from its "Package id N" channel
+ * or else from its position among the coretemp chips */
+static int
+coretemp_package(global_t *globals, const char *dir, const int *pkgs, const int npkgs){
+	const char *last = NULL;
+	thermal_t *t;
+	int i, id, ordinal = 0;
+
+	for(i = 0; i < globals->thermal_count; i++){
+		t = &thermals[i];
+		if(t->dir == dir && t->label && sscanf(t->label, "Package id %d", &id) == 1)
+			return id;
+	}
+	/* the channels of a chip are next to each other */
+	for(i = 0; i < globals->thermal_count && thermals[i].dir != dir; i++){
+		t = &thermals[i];
+		if(t->chip && !strcmp(t->chip, "coretemp") && t->dir != last){
+			last = t->dir;
+			ordinal++;
+		}
+	}
+	return ordinal < npkgs ? pkgs[ordinal] : -1;
+}
+
+/* fills the cpus bitmap of every thermal zone from the CPU topology below
+ * root. Return 0 on success, negative values on errors */
+int
+init_acpi_cpumap(global_t *globals, const char *root){
+	int pkg[MAX_CPUS], core[MAX_CPUS], pkgs[MAX_CPUS];
+	thermal_t *t;
+	int i, j, id, npkgs = 0, pkg_zones = 0, mapped = 0;
+
+	for(i = 0; i < globals->thermal_count; i++)
+		memset(thermals[i].cpus, 0, sizeof(thermals[i].cpus));
+	if(read_cpu_topology(root ? root : SYS_CPU, pkg, core) == 0)
+		return NOT_SUPPORTED;
+
+	/* the package ids in ascending order */
+	for(i = 0; i < MAX_CPUS; i++){
+		if(pkg[i] < 0)
+			continue;
+		for(j = 0; j < npkgs && pkgs[j] != pkg[i]; j++);
+		if(j == npkgs)
+			pkgs[npkgs++] = pkg[i];
+	}
+	qsort(pkgs, npkgs, sizeof(int), cmp_ints);
+
+	for(i = 0; i < globals->thermal_count; i++){
+		t = &thermals[i];
+		if(!t->label)
+			continue;
+		if(!t->chip && !strcmp(t->label, "x86_pkg_temp")){
+			/* the zones do not tell their package, the driver registers
+			 * them in package order */
+			if(pkg_zones < npkgs)
+				mapped += map_zone_cpus(t, pkg, core, pkgs[pkg_zones], -1) > 0;
+			pkg_zones++;
+		} else if(t->chip && !strcmp(t->chip, "coretemp")){
+			if(sscanf(t->label, "Package id %d", &id) == 1)
+				mapped += map_zone_cpus(t, pkg, core, id, -1) > 0;
+			else if(sscanf(t->label, "Core %d", &id) == 1)
+				mapped += map_zone_cpus(t, pkg, core,
+					coretemp_package(globals, t->dir, pkgs, npkgs), id) > 0;
+		}
+	}
+	return mapped ? SUCCESS : NOT_SUPPORTED;
+}
 
-	/* scan state file */
-	if((buf = get_acpi_content(info->state_file)) == NULL)
-		info->fan_state = F_ERR;
+/* degrees between the temperature of a zone and its lowest passive, hot
+ * or critical trip point. Returns SUCCESS or NOT_SUPPORTED if it has none */
+static int
+zone_headroom(const thermal_t *info, int *headroom){
+	int i, ret = NOT_SUPPORTED;
 
-	if(!buf || (tmp = scan_acpi_value(buf, "status:")) == NULL){
-		info->fan_state = F_ERR;
+	if(info->temperature == NOT_SUPPORTED)
 		return NOT_SUPPORTED;
+	for(i = 0; i < info->trip_count; i++){
+		if(info->trips[i].type == T_ACT)
+			continue;
+		if(ret != SUCCESS || info->trips[i].temperature - info->temperature < *headroom)
+			*headroom = info->trips[i].temperature - info->temperature;
+		ret = SUCCESS;
 	}
-	if (tmp[0] == 'o' && tmp[1] == 'n') info->fan_state = F_ON;
-	else if(tmp[0] == 'o' && tmp[1] == 'f') info->fan_state = F_OFF;
-	else info->fan_state = F_ERR;
-	free(buf);
-	free(tmp);
-	return SUCCESS;
+	return ret;
 }
 
-/* read all fans, fill the fan structures */
-static void
-read_acpi_fans(global_t *globals){
-	int i;
-	for(i = 0; i < globals->fan_count; i++)
-		read_acpi_fan(i);
+/* sort helper, most headroom first */
+static int
+cmp_headroom(const void *a, const void *b){
+	const acpi_cpu_headroom_t *x = a, *y = b;
+
+	if(x->headroom != y->headroom)
+		return y->headroom - x->headroom;
+	return x->cpu - y->cpu;
 }
 
-/* reads the names of the fan directories, fills fan_t,
- * return 0 on success, negative values on errors */
+/* rank the mapped CPUs by the headroom of their most limiting zone */
 int
-init_acpi_fan(global_t *globals){
-	char *names[MAX_ITEMS];
-	list_t *lst = NULL;
-	node_t *node = NULL;
-	int i = 0;
-	fan_t *finfo = NULL;
-	globals->fan_count = 0;
-
-	if((lst = dir_list(PROC_ACPI "fan")) == NULL || !lst->top)
-		return NOT_SUPPORTED;
-	for(node = lst->top; node; node = node->next){
-		if((names[globals->fan_count] = strdup(node->name)) == NULL){
-			delete_list(lst);
-			return ALLOC_ERR;
+acpi_coolest_cpus(global_t *globals, acpi_cpu_headroom_t *cpus, const int n){
+	acpi_cpu_headroom_t all[MAX_CPUS];
+	int slot[MAX_CPUS];
+	int i, cpu, h = 0, count = 0;
+
+	for(cpu = 0; cpu < MAX_CPUS; cpu++)
+		slot[cpu] = -1;
+	for(i = 0; i < globals->thermal_count; i++){
+		if(zone_headroom(&thermals[i], &h) != SUCCESS)
+			continue;
+		for(cpu = 0; cpu < MAX_CPUS; cpu++){
+			if(!(thermals[i].cpus[cpu / LONG_BITS] & 1UL << cpu % LONG_BITS))
+				continue;
+			if(slot[cpu] < 0){
+				slot[cpu] = count++;
+				all[slot[cpu]].cpu = cpu;
+			} else if(all[slot[cpu]].headroom <= h)
+				continue;
+			all[slot[cpu]].headroom = h;
+			all[slot[cpu]].zone = i;
 		}
-		globals->fan_count++;
 	}
-
-	if(globals->fan_count > MAX_ITEMS) return ITEM_EXCEED;
-
-	for (; i < globals->fan_count && i < MAX_ITEMS; i++){
-		finfo = &fans[i];
-		snprintf(finfo->name, MAX_NAME, "%s", names[i]);
-		snprintf(finfo->state_file, MAX_NAME, PROC_ACPI "fan/%s/state", names[i]);
-		free(names[i]);
-	}
-	delete_list(lst);
-	read_acpi_fans(globals);
-	return SUCCESS;
+	qsort(all, count, sizeof(all[0]), cmp_headroom);
+	if(count > n)
+		count = n > 0 ? n : 0;
+	memcpy(cpus, all, count * sizeof(all[0]));
+	return count;
 }
 
-/* reads the name of the thermal-zone directory and fills the adapter_t
- * structure with the name and the state-file. Return 0 on success, negative values on errors */
+/* reads the zones of the powercap class below root. Zone directories carry a
+ * name attribute, the control type directories next to them do not.
+ * Return 0 on success, negative values on errors */
 int
-init_acpi_thermal(global_t *globals){
-	char *names[MAX_ITEMS];
+init_acpi_powercap(global_t *globals, const char *root){
+	char data[MAX_BUF + 1];
+	char *names[MAX_ITEMS * 2];
+	char path[MAX_NAME];
 	list_t *lst = NULL;
 	node_t *node = NULL;
-	thermal_t *tinfo = NULL;
-	int i = 0;
-	globals->thermal_count = 0;
+	powercap_t *info;
+	const char *dir, *sep;
+	char *buf;
+	int i, j, n = 0, fd, ret = SUCCESS;
 
-	if((lst = dir_list(PROC_ACPI "thermal_zone")) == NULL)
+	close_acpi_dirs(powercaps, sizeof(powercap_t), offsetof(powercap_t, dir_fd), &open_pcaps);
+	globals->powercap_count = 0;
+
+	snprintf(path, sizeof(path), "%s", root ? root : SYS_POWERCAP);
+	if((lst = acpi_dir_list(path)) == NULL)
 		return NOT_SUPPORTED;
-	for(node = lst->top; node; node = node->next){
-		if((names[globals->thermal_count] = strdup(node->name)) == NULL){
-			delete_list(lst);
-			return ALLOC_ERR;
+	for(node = lst->top; node && n < MAX_ITEMS * 2; node = node->next)
+		names[n++] = node->name;
+	/* sorting puts every subzone right behind its parent */
+	qsort(names, n, sizeof(char *), cmp_names);
+
+	for(i = 0; i < n && globals->powercap_count < MAX_ITEMS; i++){
+		if((dir = intern("%s/%s", path, names[i])) == NULL) {
+			ret = ALLOC_ERR;
+			break;
+		}
+		fd = open_acpi_dir(dir);
+		if((buf = get_acpi_content_at(fd, dir, "name", data, sizeof(data))) == NULL) {
+			if(fd >= 0) close(fd);
+			continue;
+		}
+		info = &powercaps[globals->powercap_count];
+		info->name = intern("%s", names[i]);
+		info->label = intern("%s", buf);
+		info->dir = dir;
+		info->dir_fd = fd;
+		open_pcaps = ++globals->powercap_count;
+		if(!info->name || !info->label) {
+			ret = ALLOC_ERR;
+			break;
 		}
-		globals->thermal_count++;
-	}
-
-	if(globals->thermal_count > MAX_ITEMS) return ITEM_EXCEED;
 
-	for (; i < globals->thermal_count && i < MAX_ITEMS; i++){
-		tinfo = &thermals[i];
-		snprintf(tinfo->name, MAX_NAME, "%s", names[i]);
-		snprintf(tinfo->state_file, MAX_NAME, PROC_ACPI "thermal_zone/%s/state", names[i]);
-		snprintf(tinfo->temp_file, MAX_NAME, PROC_ACPI "thermal_zone/%s/temperature", names[i]);
-		snprintf(tinfo->cooling_file, MAX_NAME, PROC_ACPI "thermal_zone/%s/cooling_mode", names[i]);
-		snprintf(tinfo->freq_file, MAX_NAME, PROC_ACPI "thermal_zone/%s/polling_frequency", names[i]);
-		snprintf(tinfo->trips_file, MAX_NAME, PROC_ACPI "thermal_zone/%s/trip_points", names[i]);
-		free(names[i]);
+		info->max_energy = 0;
+		if((buf = get_acpi_content_at(fd, dir, "max_energy_range_uj", data, sizeof(data)))) {
+			info->max_energy = strtoull(buf, NULL, 10);
+		}
+		/* the parent of intel-rapl:0:1 is intel-rapl:0 */
+		info->parent = -1;
+		if((sep = strrchr(info->name, ':')) && strchr(info->name, ':') != sep)
+			for(j = 0; j < globals->powercap_count - 1; j++)
+				if(!strncmp(powercaps[j].name, info->name, sep - info->name) &&
+						powercaps[j].name[sep - info->name] == '\0')
+					info->parent = j;
+
+		info->energy = 0;
+		info->time = 0;
+		info->power = NOT_SUPPORTED;
+		reset_extra_attrs(ACPI_CLASS_POWERCAP, globals->powercap_count - 1);
+		read_acpi_powercap(globals->powercap_count - 1);
+		gen_stamp(&info->gen, info->field_gen, G_PCAP_GROUPS);
 	}
 	delete_list(lst);
-	read_acpi_thermalzones(globals);
-	return SUCCESS;
+	if(ret != SUCCESS){
+		globals->powercap_count = 0;
+		return ret;
+	}
+	return globals->powercap_count ? SUCCESS : NOT_SUPPORTED;
 }
 
-/* checks the string state and sets the thermal state, returns void */
-static void
-thermal_state(const char *state, thermal_t *info){
-	if(state[0] == 'o')
-		info->therm_state = T_OK;
-	else if(!strncmp (state, "crit", 4))
-		info->therm_state = T_CRIT;
-	else if (!strncmp (state, "hot", 3))
-		info->therm_state = T_HOT; else if (!strncmp (state, "pas", 3))
-		info->therm_state = T_PASS;
-	else
-		info->therm_state = T_ACT;
+/* energy between two counter values, the counter wraps to 0 after max */
+static unsigned long long
+powercap_delta(const unsigned long long from, const unsigned long long to,
+		const unsigned long long max){
+	if(to >= from)
+		return to - from;
+	/* without a known range a smaller value means the counter was reset */
+	return max > from ? max - from + to : to;
 }
 
-/* checks the string tmp and sets the cooling mode */
-static void
-fill_cooling_mode(const char *tmp, thermal_t *info){
-	if(tmp[0] == 'a')
-		info->therm_mode = CO_ACT;
-	else if(tmp[0]  == 'p')
-		info->therm_mode = CO_PASS;
-	else info->therm_mode = CO_CRIT;
+/* raw reading of the energy counter of zone num */
+int
+acpi_powercap_sample(const int num, acpi_powercap_sample_t *sample){
+	char data[MAX_BUF + 1];
+	powercap_t *info;
+	char *buf;
+
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	info = &powercaps[num];
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, "energy_uj", data, sizeof(data))) == NULL)
+		return NOT_SUPPORTED;
+	sample->time = trace_now();
+	sample->energy = strtoull(buf, NULL, 10);
+	return SUCCESS;
 }
 
-/* reads values for thermal_zone num, return 0 on success, negative values on error */
+/* average power between two readings of zone num in mW */
 int
-read_acpi_zone(const int num, global_t *globals){
-	char *buf = NULL;
-	char *tmp = NULL;
-	thermal_t *info = &thermals[num];
+acpi_powercap_power(const int num, const acpi_powercap_sample_t *from, const acpi_powercap_sample_t *to){
+	unsigned long long uj;
 
-	if(num > MAX_ITEMS) return ITEM_EXCEED;
-
-	/* scan state file */
-	if((buf = get_acpi_content(info->state_file)) == NULL)
-		info->therm_state = T_ERR;
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	if(to->time <= from->time)
+		return NOT_SUPPORTED;
+	uj = powercap_delta(from->energy, to->energy, powercaps[num].max_energy);
+	/* uJ per ns is kW, scale to mW */
+	return (int)(uj * 1000000ULL / (unsigned long long)(to->time - from->time));
+}
 
-	if(buf && (tmp = scan_acpi_value(buf, "state:")))
-			thermal_state(tmp, info);
-	free(tmp);
-	free(buf);
+/* refresh the energy and power of zone num, returns 0 on success and
+ * negative values on errors */
+int
+read_acpi_powercap(const int num){
+	powercap_t *info;
+	acpi_powercap_sample_t last, cur;
+	powercap_t old;
+
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	info = &powercaps[num];
+	refresh_begin();
+	read_extra_attrs(ACPI_CLASS_POWERCAP, num, info->dir_fd, info->dir);
+	old = *info;
+	if(acpi_powercap_sample(num, &cur) != SUCCESS){
+		info->power = NOT_SUPPORTED;
+		gen_bump(&info->gen, &info->field_gen[G_PCAP_POWER], old.power != info->power);
+		return refresh_end(NOT_SUPPORTED);
+	}
+	if(info->time){
+		last.energy = info->energy_raw;
+		last.time = info->time;
+		info->energy += powercap_delta(last.energy, cur.energy, info->max_energy);
+		info->power = acpi_powercap_power(num, &last, &cur);
+	}
+	info->energy_raw = cur.energy;
+	info->time = cur.time;
+	gen_bump(&info->gen, &info->field_gen[G_PCAP_ENERGY], old.energy != info->energy);
+	gen_bump(&info->gen, &info->field_gen[G_PCAP_POWER], old.power != info->power);
+	return refresh_end(SUCCESS);
+}
 
-	/* scan temperature file */
-	if((buf = get_acpi_content(info->temp_file)) == NULL)
-		info->temperature = NOT_SUPPORTED;
+/* the following helpers compute the derived battery values of one sample.
+ * They are shared by the refresh path and acpi_batch_calc() so both give
+ * bit-identical results, and are written branch free so the batch loops
+ * can be vectorized by the compiler. This file is built with VECFLAGS
+ * (-O3 in config.mk), gcc leaves the loops scalar at -O2 */
 
-	if(buf && (tmp = scan_acpi_value(buf, "temperature:"))){
-		info->temperature = strtol(tmp, NULL, 10);
-		/* if we just have one big thermal zone, this will be the global temperature */
-		if(globals->thermal_count == 1)
-			globals->temperature = info->temperature;
-	}
-	free(tmp);
-	free(buf);
+/* battery life status for a remaining capacity */
+static int
+calc_batt_state(const int remaining_cap, const int last_full_cap,
+		const int design_warn, const int design_low){
+	int high = last_full_cap / 2;
+	int med = high / 2;
+	int state;
+
+	/* evaluated from the lowest level up so the first match of the
+	 * highest level wins, as in an if/else chain */
+	state = remaining_cap > design_low ? B_CRIT : B_HARD_CRIT;
+	state = remaining_cap > design_warn ? B_LOW : state;
+	state = remaining_cap > med ? B_MED : state;
+	return remaining_cap > high ? B_HIGH : state;
+}
 
-	/* scan cooling mode file */
-	if((buf = get_acpi_content(info->cooling_file)) == NULL)
-		info->therm_mode = CO_ERR;
-	if(buf && (tmp = scan_acpi_value(buf, "cooling mode:")))
-		fill_cooling_mode(tmp, info);
-	else info->therm_mode = CO_ERR;
-	free(tmp);
-	free(buf);
+/* remaining percentage of the last full capacity */
+static int
+calc_perc(const int remaining_cap, const int last_full_cap){
+	float lfcap = last_full_cap <= 0 ? 1 : last_full_cap;
+	int perc = (int) ((remaining_cap / lfcap) * 100.0);
 
-	/* scan polling_frequencies file */
-	if((buf = get_acpi_content(info->freq_file)) == NULL)
-		info->frequency = DISABLED;
-	if(buf && (tmp = scan_acpi_value(buf, "polling frequency:")))
-		info->frequency = strtol(tmp, NULL, 10);
-	else info->frequency = DISABLED;
-	free(tmp);
-	free(buf);
+	return remaining_cap < 0 ? NOT_SUPPORTED : perc > 100 ? 100 : perc;
+}
 
-	/* TODO: IMPLEMENT TRIP POINTS FILE */
+/* minutes until the battery is charged, 0 if it is not charging */
+static int
+calc_chargetime(const int remaining_cap, const int last_full_cap,
+		const int present_rate, const int charge_state){
+	float rate = present_rate <= 0 ? 1 : present_rate;
+	int t = (int) ((((float)last_full_cap - (float)remaining_cap) / rate) * 60.0);
 
-	return SUCCESS;
+	/* mask instead of a branch, t must not be computed conditionally */
+	return t & -((present_rate > 0) & (charge_state == C_CHARGE));
 }
 
-/* read all thermal zones, fill the thermal structures */
-static void
-read_acpi_thermalzones(global_t *globals){
-	int i;
-	for(i = 0; i < globals->thermal_count; i++)
-		read_acpi_zone(i, globals);
+/* minutes until the battery is empty, 0 if it is not discharging */
+static int
+calc_time(const int remaining_cap, const int present_rate, const int charge_state){
+	float rate = present_rate <= 0 ? 1 : present_rate;
+	int t = (int) (((float)remaining_cap / rate) * 60.0);
+
+	return t & -((present_rate > 0) & (charge_state == C_DISCHARGE));
 }
 
 /* fill battery_state for given battery, return 0 on success or negative values on error */
 static void
 batt_charge_state(battery_t *info){
-	int high = info->last_full_cap / 2;
-	int med = high / 2;
-
-	if(info->remaining_cap > high)
-		info->batt_state = B_HIGH;
-	else if(info->remaining_cap <= high && info->remaining_cap > med)
-		info->batt_state = B_MED;
-	else if(info->remaining_cap <= med && info->remaining_cap > info->design_warn)
-		info->batt_state = B_LOW;
-	else if(info->remaining_cap <= info->design_warn && info->remaining_cap > info->design_low)
-		info->batt_state = B_CRIT;
-	else info->batt_state = B_HARD_CRIT;
+	info->batt_state = calc_batt_state(info->remaining_cap, info->last_full_cap,
+			info->design_warn, info->design_low);
 }
 
 /* fill charge_state of a given battery num, return 0 on success or negative values on error */
@@ -487,12 +1760,13 @@ fill_charge_state(const char *state, battery_t *info){
 
 /* read alarm capacity, return 0 on success, negative values on error */
 static int
-read_acpi_battalarm(const int num, const int sysstyle){
+read_acpi_battalarm(battery_t *info, const int sysstyle){
+	char data[MAX_BUF + 1];
+	char value[LINE_MAX];
 	char *buf = NULL;
 	char *tmp = NULL;
-	battery_t *info = &batteries[num];
 
-	if((buf = get_acpi_content(info->alarm_file)) == NULL)
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->alarm_file, data, sizeof(data))) == NULL)
 		return NOT_SUPPORTED;
 
 	if(sysstyle)
@@ -506,29 +1780,27 @@ read_acpi_battalarm(const int num, const int sysstyle){
 	}
 	else
 	{
-		if((tmp = scan_acpi_value(buf, "alarm:")) && tmp[0] != 'u')
+		if((tmp = scan_acpi_value(buf, "alarm:", value, sizeof(value))) && tmp[0] != 'u')
 			info->alarm = strtol(tmp, NULL, 10);
 		else
 			info->alarm = NOT_SUPPORTED;
 	}
-	free(buf);
-	free(tmp);
 	return SUCCESS;
 }
 
 /* reads static values for a battery (info file), returns SUCCESS */
 static int
 read_acpi_battinfo(const int num, const int sysstyle){
+	char data[MAX_BUF + 1];
+	char value[LINE_MAX];
 	char *buf = NULL;
 	char *tmp = NULL;
 	battery_t *info = &batteries[num];
 	int i = 0;
-	char sysfile[MAX_NAME];
 
 	if(sysstyle)
 	{
-		snprintf(sysfile, MAX_NAME, "%s/present", info->info_file);
-		if((buf = get_acpi_content(sysfile)) == NULL)
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, "present", data, sizeof(data))) == NULL)
 			return NOT_SUPPORTED;
 		if(!strcmp(buf, "1")) {
 			info->present = 1;
@@ -536,74 +1808,57 @@ read_acpi_battinfo(const int num, const int sysstyle){
 			info->present = 0;
 			return NOT_PRESENT;
 		}
-        free(buf);
 
-		snprintf(sysfile, MAX_NAME, "%s/charge_full_design", info->info_file);
-		if((buf = get_acpi_content(sysfile)) == NULL)
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, "charge_full_design", data, sizeof(data))) == NULL)
 			return NOT_SUPPORTED;
 		info->design_cap = strtol(buf, NULL, 10);
-        free(buf);
 
-		snprintf(sysfile, MAX_NAME, "%s/charge_full", info->info_file);
-		if((buf = get_acpi_content(sysfile)) == NULL)
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, "charge_full", data, sizeof(data))) == NULL)
 			return NOT_SUPPORTED;
 		info->last_full_cap = strtol(buf, NULL, 10);
-        free(buf);
 
-		snprintf(sysfile, MAX_NAME, "%s/charge_now", info->info_file);
-		if((buf = get_acpi_content(sysfile)) == NULL)
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, "charge_now", data, sizeof(data))) == NULL)
 			return NOT_SUPPORTED;
 		info->remaining_cap = strtol(buf, NULL, 10);
-        free(buf);
 
-		snprintf(sysfile, MAX_NAME, "%s/voltage_min_design", info->info_file);
-		if((buf = get_acpi_content(sysfile)) == NULL)
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, "voltage_min_design", data, sizeof(data))) == NULL)
 			return NOT_SUPPORTED;
 		info->design_voltage = strtol(buf, NULL, 10);
-        free(buf);
 
-		snprintf(sysfile, MAX_NAME, "%s/voltage_now", info->info_file);
-		if((buf = get_acpi_content(sysfile)) == NULL)
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, "voltage_now", data, sizeof(data))) == NULL)
 			return NOT_SUPPORTED;
 		info->present_voltage = strtol(buf, NULL, 10);
-        free(buf);
 
 		/* FIXME: is rate == current here? */
-		snprintf(sysfile, MAX_NAME, "%s/current_now", info->info_file);
-		if((buf = get_acpi_content(sysfile)) == NULL)
+		if((buf = get_acpi_content_at(info->dir_fd, info->dir, "current_now", data, sizeof(data))) == NULL)
 			return NOT_SUPPORTED;
 		info->present_rate = strtol(buf, NULL, 10);
-        free(buf);
 
 		return SUCCESS;
 	}
 
-	if((buf = get_acpi_content(info->info_file)) == NULL)
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->info_file, data, sizeof(data))) == NULL)
 		return NOT_SUPPORTED;
 
 	/* you have to read the present value always since a battery can be taken away while
 	 * refreshing the data */
-	if((tmp = scan_acpi_value(buf, "present:")) && !strncmp(tmp, "yes", 3)) {
-		free(tmp);
+	if((tmp = scan_acpi_value(buf, "present:", value, sizeof(value))) && !strncmp(tmp, "yes", 3)) {
 		info->present = 1;
 	} else {
 		info->present = 0;
-		free(buf);
 		return NOT_PRESENT;
 	}
 
-	if((tmp = scan_acpi_value(buf, "design capacity:")) && tmp[0] != 'u'){
+	if((tmp = scan_acpi_value(buf, "design capacity:", value, sizeof(value))) && tmp[0] != 'u'){
 		info->design_cap = strtol(tmp, NULL, 10);
 		/* workaround ACPI's broken way of reporting no battery */
 		if(info->design_cap == 655350) info->design_cap = NOT_SUPPORTED;
-		free(tmp);
 	}
 	else info->design_cap = NOT_SUPPORTED;
 
 	for (;battinfo_values[i].value; i++) {
-		if ((tmp = scan_acpi_value(buf, battinfo_values[i].value)) && tmp[0] != 'u') {
+		if ((tmp = scan_acpi_value(buf, battinfo_values[i].value, value, sizeof(value))) && tmp[0] != 'u') {
 			*((int *)(((char *)info) + battinfo_values[i].offset)) = strtol(tmp, NULL, 10);
-			free(tmp);
 		} else {
 			*((int *)(((char *)info) + battinfo_values[i].offset)) = NOT_SUPPORTED;
 		}
@@ -611,49 +1866,43 @@ read_acpi_battinfo(const int num, const int sysstyle){
 
 	/* TODO remove debug */
 	/* printf("%s\n", buf); */
-	free(buf);
 
 	return SUCCESS;
 }
 
-/* read information for battery num, return 0 on success or negative values on error */
+/* read the state of a battery, return 0 on success or negative values on error */
 static int
-read_acpi_battstate(const int num){
+read_acpi_battstate(battery_t *info){
+	char data[MAX_BUF + 1];
 	char *buf = NULL;
-	char sysfile[MAX_NAME];
-    charge_state_t cstate;
-	battery_t *info = &batteries[num];
+	charge_state_t cstate;
 
-	if((buf = get_acpi_content(info->state_file)) == NULL) {
+	if((buf = get_acpi_content_at(info->dir_fd, info->dir, info->state_file, data, sizeof(data))) == NULL) {
+		/* a slow first read does not mean the battery was removed */
+		if(read_missed)
+			return STALE;
 		info->present = 0;
 		return NOT_PRESENT;
-    } else {
+	} else {
 		info->present = 1;
 	}
 
 	/* TODO REMOVE DEBUG */
 	/* printf("%s\n\n", buf); */
 
-    cstate = fill_charge_state(buf, info);
-    free(buf);
-    if ((cstate == C_NOINFO) || (cstate == C_ERR)) {
-        return NOT_SUPPORTED;
-    }
+	cstate = fill_charge_state(buf, info);
+	if ((cstate == C_NOINFO) || (cstate == C_ERR)) {
+		return NOT_SUPPORTED;
+	}
 
-    snprintf(sysfile, MAX_NAME, "%s/charge_now", info->info_file);
-    if ((buf = get_acpi_content(sysfile)) != NULL)
-        info->remaining_cap = strtol(buf, NULL, 10);
-    free(buf);
+	if ((buf = get_acpi_content_at(info->dir_fd, info->dir, "charge_now", data, sizeof(data))) != NULL)
+		info->remaining_cap = strtol(buf, NULL, 10);
 
-    snprintf(sysfile, MAX_NAME, "%s/voltage_now", info->info_file);
-    if ((buf = get_acpi_content(sysfile)) != NULL)
-        info->present_voltage = strtol(buf, NULL, 10);
-    free(buf);
+	if ((buf = get_acpi_content_at(info->dir_fd, info->dir, "voltage_now", data, sizeof(data))) != NULL)
+		info->present_voltage = strtol(buf, NULL, 10);
 
-    snprintf(sysfile, MAX_NAME, "%s/current_now", info->info_file);
-    if ((buf = get_acpi_content(sysfile)) != NULL)
-        info->present_rate = strtol(buf, NULL, 10);
-    free(buf);
+	if ((buf = get_acpi_content_at(info->dir_fd, info->dir, "current_now", data, sizeof(data))) != NULL)
+		info->present_rate = strtol(buf, NULL, 10);
 
 	/* get information from the info file */
 	batt_charge_state(info);
@@ -661,60 +1910,564 @@ read_acpi_battstate(const int num){
 	return SUCCESS;
 }
 
-/* calculate percentage of battery capacity num */
+/* calculate percentage of battery capacity */
 static void
-calc_remain_perc(const int num){
-	float lfcap;
-	battery_t *info = &batteries[num];
-	int perc;
+calc_remain_perc(battery_t *info){
+	info->percentage = calc_perc(info->remaining_cap, info->last_full_cap);
+}
 
-	if(info->remaining_cap < 0){
-		info->percentage = NOT_SUPPORTED;
-		return;
-	}
-	else{
-		lfcap = info->last_full_cap;
-		if(lfcap <= 0) lfcap = 1;
-		perc = (int) ((info->remaining_cap / lfcap) * 100.0);
-	}
-	info->percentage = perc > 100 ? 100 : perc;
+/* calculate remaining charge time of a battery */
+static void
+calc_remain_chargetime(battery_t *info){
+	info->charge_time = calc_chargetime(info->remaining_cap, info->last_full_cap,
+			info->present_rate, info->charge_state);
 }
 
-/* calculate remaining charge time for battery num */
+/* calculate remaining time of a battery */
 static void
-calc_remain_chargetime(const int num){
-	battery_t *info = &batteries[num];
+calc_remain_time(battery_t *info){
+	info->remaining_time = calc_time(info->remaining_cap, info->present_rate, info->charge_state);
+}
 
-	if(info->present_rate < 0 || info->charge_state != C_CHARGE){
-		info->charge_time = 0;
-		return;
+/* compute the derived values for columns of raw samples. Every output
+ * column is filled by its own loop over plain arrays so the compiler can
+ * vectorize them at -O3, returns SUCCESS or NOT_SUPPORTED if an input is missing */
+int
+acpi_batch_calc(acpi_batch_t *batch){
+	const int *rc = batch->remaining_cap;
+	const int *lfc = batch->last_full_cap;
+	const int *rate = batch->present_rate;
+	const int *cs = batch->charge_state;
+	size_t i, n = batch->rows;
+
+	if(!rc || !lfc)
+		return NOT_SUPPORTED;
+	if((batch->charge_time || batch->remaining_time) && (!rate || !cs))
+		return NOT_SUPPORTED;
+	if(batch->batt_state && (!batch->design_warn || !batch->design_low))
+		return NOT_SUPPORTED;
+
+	if(batch->percentage){
+		int *out = batch->percentage;
+		for(i = 0; i < n; i++)
+			out[i] = calc_perc(rc[i], lfc[i]);
+	}
+	if(batch->charge_time){
+		int *out = batch->charge_time;
+		for(i = 0; i < n; i++)
+			out[i] = calc_chargetime(rc[i], lfc[i], rate[i], cs[i]);
+	}
+	if(batch->remaining_time){
+		int *out = batch->remaining_time;
+		for(i = 0; i < n; i++)
+			out[i] = calc_time(rc[i], rate[i], cs[i]);
+	}
+	if(batch->batt_state){
+		const int *warn = batch->design_warn;
+		const int *low = batch->design_low;
+		int *out = batch->batt_state;
+		for(i = 0; i < n; i++)
+			out[i] = calc_batt_state(rc[i], lfc[i], warn[i], low[i]);
 	}
-	info->charge_time = (int) ((((float)info->last_full_cap - (float)info->remaining_cap) / info->present_rate) * 60.0);
+	return SUCCESS;
 }
 
-/* calculate remaining time for battery num */
+/* bump the generations of all field groups of a battery which changed */
 static void
-calc_remain_time(const int num){
-	battery_t *info = &batteries[num];
+batt_track(const battery_t *old, battery_t *info){
+	gen_bump(&info->gen, &info->field_gen[G_BATT_PRESENT], old->present != info->present);
+	gen_bump(&info->gen, &info->field_gen[G_BATT_CHARGE], old->charge_state != info->charge_state);
+	gen_bump(&info->gen, &info->field_gen[G_BATT_STATE], old->batt_state != info->batt_state);
+	gen_bump(&info->gen, &info->field_gen[G_BATT_LEVEL],
+			old->remaining_cap != info->remaining_cap ||
+			old->last_full_cap != info->last_full_cap ||
+			old->present_rate != info->present_rate ||
+			old->present_voltage != info->present_voltage ||
+			old->percentage != info->percentage ||
+			old->charge_time != info->charge_time ||
+			old->remaining_time != info->remaining_time);
+	gen_bump(&info->gen, &info->field_gen[G_BATT_ALARM], old->alarm != info->alarm);
+}
 
-	if(info->present_rate < 0 || info->charge_state != C_DISCHARGE){
-		info->remaining_time = 0;
-		return;
-	}
-	info->remaining_time = (int) (((float)info->remaining_cap / (float)info->present_rate) * 60.0);
+/* refresh the values of a battery, called between refresh_begin() and
+ * refresh_end(). Returns 0 on SUCCESS, negative values on errors */
+static int
+batt_refresh(battery_t *info){
+	battery_t old = *info;
+	int ret = -1, state;
+
+	if ((state = read_acpi_battstate(info)) == SUCCESS) {
+        read_acpi_battalarm(info, 0);
+        calc_remain_perc(info);
+        calc_remain_chargetime(info);
+        calc_remain_time(info);
+        ret = SUCCESS;
+    } else if (state == STALE)
+		ret = STALE;
+	batt_track(&old, info);
+	return ret;
 }
 
 /* read/refresh information about a given battery num
  * returns 0 on SUCCESS, negative values on errors */
 int
 read_acpi_batt(const int num){
-	if(num > MAX_ITEMS) return ITEM_EXCEED;
-	if (read_acpi_battstate(num) == SUCCESS) {
-        read_acpi_battalarm(num, 0);
-        calc_remain_perc(num);
-        calc_remain_chargetime(num);
-        calc_remain_time(num);
-        return SUCCESS;
-    }
-    return -1;
+	battery_t *info;
+
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	info = &batteries[num];
+	refresh_begin();
+	read_extra_attrs(ACPI_CLASS_BATTERY, num, info->dir_fd, info->dir);
+	return refresh_end(batt_refresh(info));
+}
+
+/* refresh a copy of battery num, batteries[] is not touched */
+int
+read_acpi_batt_copy(const int num, battery_t *info){
+	if(num < 0 || num >= MAX_ITEMS) return ITEM_EXCEED;
+	refresh_begin();
+	return refresh_end(batt_refresh(info));
+}
+
+/* returns the current generation */
+unsigned long
+acpi_generation(void){
+	return atomic_load(&generation);
+}
+
+/* walk all field groups of all devices and yield the ones changed after
+ * change->since, returns SUCCESS for each change and NOT_PRESENT at the end */
+int
+acpi_changes(global_t *globals, acpi_change_t *change){
+	unsigned long *dev, *field;
+	int p, num, groups;
+	acpi_class_t cls;
+
+	if(atomic_load(&generation) <= change->since)
+		return NOT_PRESENT;
+
+	for(; ; change->pos++){
+		p = change->pos;
+		if(p < G_AC_GROUPS){
+			cls = ACPI_CLASS_AC;
+			num = 0;
+			groups = G_AC_GROUPS;
+			dev = &globals->adapt.gen;
+			field = globals->adapt.field_gen;
+		} else if((p -= G_AC_GROUPS) < globals->batt_count * G_BATT_GROUPS){
+			cls = ACPI_CLASS_BATTERY;
+			num = p / G_BATT_GROUPS;
+			groups = G_BATT_GROUPS;
+			dev = &batteries[num].gen;
+			field = batteries[num].field_gen;
+		} else if((p -= globals->batt_count * G_BATT_GROUPS) < globals->thermal_count * G_ZONE_GROUPS){
+			cls = ACPI_CLASS_ZONE;
+			num = p / G_ZONE_GROUPS;
+			groups = G_ZONE_GROUPS;
+			dev = &thermals[num].gen;
+			field = thermals[num].field_gen;
+		} else if((p -= globals->thermal_count * G_ZONE_GROUPS) < globals->fan_count * G_FAN_GROUPS){
+			cls = ACPI_CLASS_FAN;
+			num = p / G_FAN_GROUPS;
+			groups = G_FAN_GROUPS;
+			dev = &fans[num].gen;
+			field = fans[num].field_gen;
+		} else if((p -= globals->fan_count * G_FAN_GROUPS) < globals->powercap_count * G_PCAP_GROUPS){
+			cls = ACPI_CLASS_POWERCAP;
+			num = p / G_PCAP_GROUPS;
+			groups = G_PCAP_GROUPS;
+			dev = &powercaps[num].gen;
+			field = powercaps[num].field_gen;
+		} else
+			return NOT_PRESENT;
+
+		p %= groups;
+		/* skip whole devices which did not change at all */
+		if(*dev <= change->since){
+			change->pos += groups - p - 1;
+			continue;
+		}
+		if(field[p] > change->since){
+			change->dev_class = cls;
+			change->num = num;
+			change->field = p;
+			change->gen = field[p];
+			change->pos++;
+			return SUCCESS;
+		}
+	}
+}
+
+/* the discovery cache holds the device arrays of a discovery, the string
+ * fields of a device follow it, written as length and bytes */
+#define DISCOVERY_VERSION 2
+#define NO_STRING 0xffff
+/* input_fd of a loaded device whose input file was open when it was saved */
+#define INPUT_SAVED -2
+
+static const char discovery_magic[4] = { 'L', 'A', 'C', 'D' };
+
+/* directories whose entries are the devices. sysfs is kernfs, whose
+ * directory mtimes do not reliably change when a device appears or goes
+ * away, so the number of entries is part of the key as well */
+static const char *discovery_dirs[] = {
+	SYS_POWER, SYS_THERMAL, SYS_HWMON, SYS_POWERCAP, PROC_ACPI "battery",
+	PROC_ACPI "ac_adapter", PROC_ACPI "thermal_zone", PROC_ACPI "fan"
+};
+
+#define DISCOVERY_DIRS (sizeof(discovery_dirs) / sizeof(discovery_dirs[0]))
+
+/* the cache is only valid if all of it matches the running system */
+typedef struct {
+	char magic[4];
+	int version;
+	unsigned int sizes[ACPI_CLASSES];
+	char boot_id[40];
+	char cpus_online[64];
+	long long mtime[DISCOVERY_DIRS];
+	int entries[DISCOVERY_DIRS];
+} discovery_key_t;
+
+static const size_t batt_strings[] = {
+	offsetof(battery_t, name), offsetof(battery_t, dir), offsetof(battery_t, state_file),
+	offsetof(battery_t, info_file), offsetof(battery_t, alarm_file)
+};
+static const size_t adapter_strings[] = {
+	offsetof(adapter_t, name), offsetof(adapter_t, dir), offsetof(adapter_t, state_file)
+};
+static const size_t zone_strings[] = {
+	offsetof(thermal_t, name), offsetof(thermal_t, dir), offsetof(thermal_t, state_file),
+	offsetof(thermal_t, cooling_file), offsetof(thermal_t, freq_file),
+	offsetof(thermal_t, trips_file), offsetof(thermal_t, temp_file),
+	offsetof(thermal_t, chip), offsetof(thermal_t, label)
+};
+static const size_t fan_strings[] = {
+	offsetof(fan_t, name), offsetof(fan_t, dir), offsetof(fan_t, state_file),
+	offsetof(fan_t, chip), offsetof(fan_t, label)
+};
+static const size_t pcap_strings[] = {
+	offsetof(powercap_t, name), offsetof(powercap_t, label), offsetof(powercap_t, dir)
+};
+
+typedef struct {
+	void *devs;
+	size_t size;
+	size_t count;                /* offset of the device count in global_t */
+	size_t dir_fd;               /* offset of the directory handle in the device */
+	const size_t *strings;
+	size_t string_count;
+} discovery_class_t;
+
+/* in acpi_class_t order */
+static const discovery_class_t discovery_classes[ACPI_CLASSES] = {
+	{ adapters, sizeof(adapter_t), offsetof(global_t, adapt_count),
+		offsetof(adapter_t, dir_fd), adapter_strings, 3 },
+	{ batteries, sizeof(battery_t), offsetof(global_t, batt_count),
+		offsetof(battery_t, dir_fd), batt_strings, 5 },
+	{ thermals, sizeof(thermal_t), offsetof(global_t, thermal_count),
+		offsetof(thermal_t, dir_fd), zone_strings, 9 },
+	{ fans, sizeof(fan_t), offsetof(global_t, fan_count),
+		offsetof(fan_t, dir_fd), fan_strings, 5 },
+	{ powercaps, sizeof(powercap_t), offsetof(global_t, powercap_count),
+		offsetof(powercap_t, dir_fd), pcap_strings, 3 }
+};
+
+/* number of entries of a directory, -1 if it cannot be listed */
+static int
+count_entries(const char *dir){
+	struct dirent *de;
+	DIR *d;
+	int n = 0;
+
+	if((d = opendir(dir)) == NULL)
+		return -1;
+	while((de = readdir(d)))
+		if(strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+			n++;
+	closedir(d);
+	return n;
+}
+
+/* the cache file to use, path if given, else below $XDG_RUNTIME_DIR or
+ * ACPI_DISCOVERY_CACHE. Returns NULL if the name does not fit into buf */
+static const char *
+discovery_path(const char *path, char *buf, const size_t size){
+	const char *run = getenv("XDG_RUNTIME_DIR");
+
+	if(path)
+		return path;
+	if(!run || run[0] != '/')
+		return ACPI_DISCOVERY_CACHE;
+	if((size_t)snprintf(buf, size, "%s/libacpi.cache", run) >= size)
+		return NULL;
+	return buf;
+}
+
+/* fill the validation key for the running system */
+static void
+discovery_key(discovery_key_t *key){
+	char data[MAX_BUF + 1];
+	struct stat st;
+	char *buf;
+	size_t i;
+
+	memset(key, 0, sizeof(*key));
+	memcpy(key->magic, discovery_magic, sizeof(key->magic));
+	key->version = DISCOVERY_VERSION;
+	for(i = 0; i < ACPI_CLASSES; i++)
+		key->sizes[i] = discovery_classes[i].size;
+	if((buf = get_acpi_content("/proc/sys/kernel/random/boot_id", data, sizeof(data))))
+		snprintf(key->boot_id, sizeof(key->boot_id), "%s", buf);
+	/* the CPU map depends on the online CPUs */
+	if((buf = get_acpi_content(SYS_CPU "/online", data, sizeof(data))))
+		snprintf(key->cpus_online, sizeof(key->cpus_online), "%s", buf);
+	for(i = 0; i < DISCOVERY_DIRS; i++){
+		key->mtime[i] = stat(discovery_dirs[i], &st) ? -1 :
+			st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+		key->entries[i] = count_entries(discovery_dirs[i]);
+	}
+}
+
+static void
+put_string(FILE *f, const char *s){
+	unsigned short len = s ? strlen(s) : NO_STRING;
+
+	fwrite(&len, sizeof(len), 1, f);
+	if(s)
+		fwrite(s, 1, len, f);
+}
+
+/* read a string at *pos and intern it, returns SUCCESS, BAD_FORMAT or ALLOC_ERR */
+static int
+get_string(const char *map, const size_t size, size_t *pos, const char **s){
+	unsigned short len;
+
+	if(size - *pos < sizeof(len))
+		return BAD_FORMAT;
+	memcpy(&len, map + *pos, sizeof(len));
+	*pos += sizeof(len);
+	if(len == NO_STRING){
+		*s = NULL;
+		return SUCCESS;
+	}
+	if(len >= MAX_NAME || size - *pos < len)
+		return BAD_FORMAT;
+	*pos += len;
+	return (*s = intern("%.*s", (int)len, map + *pos - len)) ? SUCCESS : ALLOC_ERR;
+}
+
+/* write the discovered devices and the validation key into the cache */
+int
+acpi_discovery_save(global_t *globals, const char *path){
+	char tmp[MAX_NAME], buf[MAX_NAME];
+	discovery_key_t key;
+	const discovery_class_t *c;
+	const char *dev;
+	int head[2 + ACPI_CLASSES];
+	size_t i, j;
+	int n, fd, ret;
+	FILE *f;
+
+	if(trace_mode != TRACE_OFF)
+		return DISABLED;
+	if((path = discovery_path(path, buf, sizeof(buf))) == NULL)
+		return NOT_SUPPORTED;
+	discovery_key(&key);
+	head[0] = globals->sysstyle;
+	head[1] = cached_version ? cached_version : get_acpi_version();
+	for(i = 0; i < ACPI_CLASSES; i++)
+		head[2 + i] = *(int *)((char *)globals + discovery_classes[i].count);
+
+	/* written next to the cache and renamed, readers never see half a
+	 * file. mkstemp() creates it exclusively, a file or symlink planted
+	 * under the name is never followed */
+	if((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+		return NOT_SUPPORTED;
+	if((fd = mkstemp(tmp)) < 0)
+		return NOT_SUPPORTED;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if(fchmod(fd, 0644) || (f = fdopen(fd, "wb")) == NULL){
+		close(fd);
+		unlink(tmp);
+		return NOT_SUPPORTED;
+	}
+	fwrite(&key, sizeof(key), 1, f);
+	fwrite(head, sizeof(head), 1, f);
+	for(i = 0; i < ACPI_CLASSES; i++){
+		c = &discovery_classes[i];
+		for(n = 0; n < head[2 + i]; n++){
+			dev = (const char *)c->devs + n * c->size;
+			fwrite(dev, c->size, 1, f);
+			for(j = 0; j < c->string_count; j++)
+				put_string(f, *(const char * const *)(dev + c->strings[j]));
+		}
+	}
+	ret = ferror(f);
+	if(fclose(f) || ret || rename(tmp, path)){
+		unlink(tmp);
+		return NOT_SUPPORTED;
+	}
+	return SUCCESS;
+}
+
+/* open the handles of the loaded devices and prepare them like a discovery
+ * would, returns SUCCESS or NOT_PRESENT if a device went away */
+static int
+discovery_open(global_t *globals){
+	thermal_t *t;
+	fan_t *f;
+	int i, ret = SUCCESS;
+
+	for(i = 0; i < globals->adapt_count; i++){
+		if((adapters[i].dir_fd = open_acpi_dir(adapters[i].dir)) < 0)
+			ret = NOT_PRESENT;
+		reset_extra_attrs(ACPI_CLASS_AC, i);
+		gen_stamp(&adapters[i].gen, adapters[i].field_gen, G_AC_GROUPS);
+	}
+	for(i = 0; i < globals->batt_count; i++){
+		if((batteries[i].dir_fd = open_acpi_dir(batteries[i].dir)) < 0)
+			ret = NOT_PRESENT;
+		reset_extra_attrs(ACPI_CLASS_BATTERY, i);
+		gen_stamp(&batteries[i].gen, batteries[i].field_gen, G_BATT_GROUPS);
+	}
+	for(i = 0; i < globals->thermal_count; i++){
+		t = &thermals[i];
+		if((t->dir_fd = open_acpi_dir(t->dir)) < 0 || (t->input_fd == INPUT_SAVED &&
+				(t->input_fd = openat(t->dir_fd, t->temp_file, O_RDONLY | O_CLOEXEC)) < 0))
+			ret = NOT_PRESENT;
+		forecast_reset(i);
+		reset_extra_attrs(ACPI_CLASS_ZONE, i);
+		gen_stamp(&t->gen, t->field_gen, G_ZONE_GROUPS);
+	}
+	for(i = 0; i < globals->fan_count; i++){
+		f = &fans[i];
+		if((f->dir_fd = open_acpi_dir(f->dir)) < 0 || (f->input_fd == INPUT_SAVED &&
+				(f->input_fd = openat(f->dir_fd, f->state_file, O_RDONLY | O_CLOEXEC)) < 0))
+			ret = NOT_PRESENT;
+		reset_extra_attrs(ACPI_CLASS_FAN, i);
+		gen_stamp(&f->gen, f->field_gen, G_FAN_GROUPS);
+	}
+	for(i = 0; i < globals->powercap_count && ret == SUCCESS; i++){
+		if((powercaps[i].dir_fd = open_acpi_dir(powercaps[i].dir)) < 0){
+			ret = NOT_PRESENT;
+			break;
+		}
+		powercaps[i].energy = 0;
+		powercaps[i].time = 0;
+		powercaps[i].power = NOT_SUPPORTED;
+		reset_extra_attrs(ACPI_CLASS_POWERCAP, i);
+		read_acpi_powercap(i);
+		gen_stamp(&powercaps[i].gen, powercaps[i].field_gen, G_PCAP_GROUPS);
+	}
+	return ret;
+}
+
+/* check the counts and indices of a loaded device, the rest of the code
+ * trusts them. Returns SUCCESS or BAD_FORMAT */
+static int
+discovery_check(const int cls, const int num, const int pcaps){
+	thermal_t *t = &thermals[num];
+	int i;
+
+	if(cls == ACPI_CLASS_ZONE){
+		if(t->trip_count < 0 || t->trip_count > MAX_TRIPS)
+			return BAD_FORMAT;
+		for(i = 0; i < t->trip_count; i++)
+			if(t->trips[i].type < T_CRIT || t->trips[i].type > T_ACT)
+				return BAD_FORMAT;
+	} else if(cls == ACPI_CLASS_POWERCAP &&
+			(powercaps[num].parent < -1 || powercaps[num].parent >= pcaps))
+		return BAD_FORMAT;
+	return SUCCESS;
+}
+
+/* read the devices from the cache, nothing of the system is listed */
+int
+acpi_discovery_load(global_t *globals, const char *path){
+	char buf[MAX_NAME];
+	discovery_key_t key;
+	const discovery_class_t *c;
+	struct stat st;
+	const char *map;
+	char *dev;
+	int head[2 + ACPI_CLASSES];
+	size_t i, j, pos;
+	int n, fd, ret = SUCCESS;
+
+	if(trace_mode != TRACE_OFF)
+		return DISABLED;
+	if((path = discovery_path(path, buf, sizeof(buf))) == NULL)
+		return NOT_PRESENT;
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return NOT_PRESENT;
+	if(fstat(fd, &st) || (size_t)st.st_size < sizeof(key) + sizeof(head)){
+		close(fd);
+		return BAD_FORMAT;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return NOT_SUPPORTED;
+	discovery_key(&key);
+	if(memcmp(map, &key, sizeof(key))){
+		munmap((void *)map, st.st_size);
+		return NOT_PRESENT;
+	}
+	memcpy(head, map + sizeof(key), sizeof(head));
+	for(i = 0; i < ACPI_CLASSES; i++)
+		if(head[2 + i] < 0 || head[2 + i] > MAX_ITEMS){
+			munmap((void *)map, st.st_size);
+			return BAD_FORMAT;
+		}
+
+	close_acpi(globals);
+	pos = sizeof(key) + sizeof(head);
+	for(i = 0; i < ACPI_CLASSES && ret == SUCCESS; i++){
+		c = &discovery_classes[i];
+		for(n = 0; n < head[2 + i] && ret == SUCCESS; n++){
+			dev = (char *)c->devs + n * c->size;
+			if((size_t)st.st_size - pos < c->size){
+				ret = BAD_FORMAT;
+				break;
+			}
+			memcpy(dev, map + pos, c->size);
+			pos += c->size;
+			if(discovery_check(i, n, head[2 + ACPI_CLASS_POWERCAP]) != SUCCESS){
+				ret = BAD_FORMAT;
+				break;
+			}
+			for(j = 0; j < c->string_count && ret == SUCCESS; j++)
+				ret = get_string(map, st.st_size, &pos, (const char **)(dev + c->strings[j]));
+		}
+	}
+	munmap((void *)map, st.st_size);
+
+	/* the handles are the ones of the cache writer, close_acpi() must
+	 * not see them. Inputs which were open are marked to be opened */
+	for(i = 0; i < ACPI_CLASSES; i++){
+		c = &discovery_classes[i];
+		for(n = 0; n < head[2 + i]; n++)
+			*(int *)((char *)c->devs + n * c->size + c->dir_fd) = -1;
+	}
+	for(n = 0; n < head[2 + ACPI_CLASS_ZONE]; n++)
+		thermals[n].input_fd = thermals[n].input_fd >= 0 ? INPUT_SAVED : -1;
+	for(n = 0; n < head[2 + ACPI_CLASS_FAN]; n++)
+		fans[n].input_fd = fans[n].input_fd >= 0 ? INPUT_SAVED : -1;
+	if(ret != SUCCESS)
+		return ret;
+
+	globals->sysstyle = head[0];
+	globals->adapt_count = open_adapters = head[2 + ACPI_CLASS_AC];
+	globals->batt_count = open_batts = head[2 + ACPI_CLASS_BATTERY];
+	globals->thermal_count = open_zones = head[2 + ACPI_CLASS_ZONE];
+	globals->fan_count = open_fans = head[2 + ACPI_CLASS_FAN];
+	globals->powercap_count = open_pcaps = head[2 + ACPI_CLASS_POWERCAP];
+	if((ret = discovery_open(globals)) != SUCCESS){
+		close_acpi(globals);
+		return ret;
+	}
+	if(globals->adapt_count)
+		setup_global_adapter(globals);
+	cached_version = head[1];
+	return SUCCESS;
 }
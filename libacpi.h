@@ -11,19 +11,34 @@
 #ifndef __LIBACPI_H__
 #define __LIBACPI_H__
 
+#include <stddef.h>
+
 #define PROC_ACPI "/proc/acpi/"
 #define SYS_POWER "/sys/class/power_supply"
+#define SYS_POWERCAP "/sys/class/powercap"
+#define SYS_HWMON "/sys/class/hwmon"
+#define SYS_THERMAL "/sys/class/thermal"
+#define SYS_CPU "/sys/devices/system/cpu"
+#define ACPID_SOCKET "/var/run/acpid.socket"
+#define ACPI_DISCOVERY_CACHE "/run/libacpi.cache"
 
 #define LINE_MAX 256
 #define MAX_NAME 512
 #define MAX_BUF 1024
-#define MAX_ITEMS 10
+#define MAX_ITEMS 32
+#define STRTAB_SIZE (16 * 1024)
+#define MAX_TRIPS 8
+#define MAX_CPUS 256
+#define CPU_WORDS (MAX_CPUS / (8 * sizeof(unsigned long)))
 
 /**
  * \enum return values
  * \brief return values of internal functions
  */
 enum {
+	STALE = -8,          /**< values are the last good ones, a read missed its deadline */
+	BAD_FORMAT = -7,     /**< data is malformed or of an unknown version */
+	BUF_EXCEED = -6,     /**< caller supplied buffer is too small */
 	ITEM_EXCEED = -5,    /**< maximum item count reached */
 	DISABLED = -4,       /**< feature is disabled */
 	NOT_PRESENT = -3,    /**< something is not present */
@@ -42,6 +57,18 @@ typedef enum {
 	P_ERR                /**< no information can be found */
 } power_state_t;
 
+/**
+ * \enum supply_type_t
+ * \brief kind of a power supply, from its type attribute
+ */
+typedef enum {
+	S_BATTERY,           /**< battery */
+	S_MAINS,             /**< ac adapter */
+	S_USB,               /**< USB or USB-C power source */
+	S_UPS,               /**< uninterruptible power supply */
+	S_UNKNOWN            /**< anything else, ignored */
+} supply_type_t;
+
 /**
  * \struct thermal_state_t
  * \brief thermal zone states
@@ -101,74 +128,212 @@ typedef enum {
 	F_ERR         /**< some error occurred with this fan */
 } fan_state_t;
 
+/**
+ * \enum acpi_class_t
+ * \brief device classes
+ */
+typedef enum {
+	ACPI_CLASS_AC,       /**< ac adapter, globals->adapt */
+	ACPI_CLASS_BATTERY,  /**< batteries[] */
+	ACPI_CLASS_ZONE,     /**< thermals[] */
+	ACPI_CLASS_FAN,      /**< fans[] */
+	ACPI_CLASS_POWERCAP, /**< powercaps[] */
+	ACPI_CLASSES         /**< number of device classes */
+} acpi_class_t;
+
+/**
+ * \enum field groups
+ * \brief groups of fields tracked by generation counters, per device class
+ */
+enum {
+	G_AC_STATE,          /**< adapter_t ac_state */
+	G_AC_GROUPS
+};
+
+enum {
+	G_BATT_PRESENT,      /**< battery_t present */
+	G_BATT_CHARGE,       /**< battery_t charge_state */
+	G_BATT_STATE,        /**< battery_t batt_state */
+	G_BATT_LEVEL,        /**< capacities, rate, voltage, percentage and times */
+	G_BATT_ALARM,        /**< battery_t alarm */
+	G_BATT_GROUPS
+};
+
+enum {
+	G_ZONE_TEMP,         /**< thermal_t temperature */
+	G_ZONE_STATE,        /**< thermal_t therm_state */
+	G_ZONE_MODE,         /**< thermal_t therm_mode */
+	G_ZONE_FREQ,         /**< thermal_t frequency */
+	G_ZONE_GROUPS
+};
+
+enum {
+	G_FAN_STATE,         /**< fan_t fan_state */
+	G_FAN_SPEED,         /**< fan_t rpm */
+	G_FAN_GROUPS
+};
+
+enum {
+	G_PCAP_ENERGY,       /**< powercap_t energy */
+	G_PCAP_POWER,        /**< powercap_t power */
+	G_PCAP_GROUPS
+};
+
+/**
+ * Device records are aligned to a cache line so iterating the numeric
+ * state of several devices does not share lines between them
+ */
+#ifdef __GNUC__
+#define ACPI_CACHE_ALIGNED __attribute__((aligned(64)))
+#else
+#define ACPI_CACHE_ALIGNED
+#endif
+
 /**
  * \struct fan_t
  * \brief fan data
  */
 typedef struct {
-	char name[MAX_NAME];         /**< name of the fan found in proc vfs */
-	char state_file[MAX_NAME];   /**< state file for the fan */
 	fan_state_t fan_state;       /**< current status of the found fan */
-} fan_t;
+	int rpm;                     /**< speed of a hwmon fan, NOT_SUPPORTED for acpi fans */
+	int dir_fd;                  /**< handle of the fan directory, files are read relative to it */
+	int input_fd;                /**< open speed file of a hwmon fan, -1 for acpi fans, another negative value while a trace is replayed */
+	unsigned long gen;           /**< generation of the last change */
+	unsigned long field_gen[G_FAN_GROUPS]; /**< generation of the last change per field group */
+
+	/* interned strings, see acpi_strtab_size() */
+	const char *name;            /**< name of the fan found in proc vfs, hwmonN/fanM for hwmon */
+	const char *dir;             /**< fan directory */
+	const char *state_file;      /**< state file for the fan, relative to dir */
+	const char *chip;            /**< hwmon chip name, NULL for acpi fans */
+	const char *label;           /**< hwmon channel label, NULL if there is none */
+} ACPI_CACHE_ALIGNED fan_t;
 
 /**
  * \struct battery_t
  * \brief information found about battery
  */
 typedef struct {
-	char name[MAX_NAME];         /**< name of the battery found in proc vfs */
-	char state_file[MAX_NAME];   /**< corresponding state file name + path */
-	char info_file[MAX_NAME];    /**< corresponding info file + path */
-	char alarm_file[MAX_NAME];   /**< corresponding alarm file + path */
+	int dir_fd;                  /**< handle of the battery directory, files are read relative to it */
+
+	/* state info, refreshed by read_acpi_batt() */
 	int present;                 /**< battery slot is currently used by a battery or not? 0 if not, 1 if yes */
-	int design_cap;              /**< assuming capacity in mAh*/
+	int remaining_cap;           /**< remaining capacity, used to calculate percentage */
 	int last_full_cap;           /**< last full capacity when the battery was fully charged */
-	int design_voltage;          /**< design voltage in mV */
 	int present_rate;            /**< present rate consuming the battery */
-	int remaining_cap;           /**< remaining capacity, used to calculate percentage */
 	int present_voltage;         /**< present voltage */
-	int design_warn;             /**< specifies how many mAh need to be left to have a hardware warning */
-	int design_low;              /**< specifies how many mAh need to be left before the battery is low */
-	int design_level1;           /**< capacity granularity 1 */
-	int design_level2;           /**< capacity granularity 2 */
 	int alarm;                   /**< generate hardware alarm in alarm "units" */
+	charge_state_t charge_state; /**< charge state of battery */
+	batt_state_t batt_state;     /**< battery capacity state */
 	/* calculated states */
 	int percentage;              /**< remaining battery percentage */
 	int charge_time;             /**< remaining time to fully charge the battery in minutes */
 	int remaining_time;          /**< remaining battery life time in minutes */
 
-	/* state info */
-	charge_state_t charge_state; /**< charge state of battery */
-	batt_state_t batt_state;     /**< battery capacity state */
-} battery_t;
+	/* static info */
+	int design_cap;              /**< assuming capacity in mAh*/
+	int design_voltage;          /**< design voltage in mV */
+	int design_warn;             /**< specifies how many mAh need to be left to have a hardware warning */
+	int design_low;              /**< specifies how many mAh need to be left before the battery is low */
+	int design_level1;           /**< capacity granularity 1 */
+	int design_level2;           /**< capacity granularity 2 */
+
+	unsigned long gen;           /**< generation of the last change */
+	unsigned long field_gen[G_BATT_GROUPS]; /**< generation of the last change per field group */
+
+	/* interned strings, see acpi_strtab_size() */
+	const char *name;            /**< name of the battery found in proc vfs */
+	const char *dir;             /**< battery directory */
+	const char *state_file;      /**< corresponding state file, relative to dir */
+	const char *info_file;       /**< corresponding info file, relative to dir */
+	const char *alarm_file;      /**< corresponding alarm file, relative to dir */
+} ACPI_CACHE_ALIGNED battery_t;
+
+/**
+ * \struct acpi_trip_t
+ * \brief trip point of a thermal zone
+ */
+typedef struct {
+	int temperature;              /**< temperature of the trip point in degrees Celsius */
+	thermal_state_t type;         /**< T_CRIT, T_HOT, T_PASS or T_ACT */
+} acpi_trip_t;
 
 /**
  * \struct thermal_t
  * \brief information about thermal zone
  */
 typedef struct {
-	char name[MAX_NAME];          /**< name of the thermal zone */
 	int temperature;              /**< current temperature of the zone */
 	int frequency;                /**< polling frequency for this zone */
-	char state_file[MAX_NAME];    /**< state file + path of the zone */
-	char cooling_file[MAX_NAME];  /**< cooling mode file + path */
-	char freq_file[MAX_NAME];     /**< polling frequency file + path */
-	char trips_file[MAX_NAME];    /**< trip points file + path */
-	char temp_file[MAX_NAME];     /**< temperature file + path */
 	thermal_mode_t therm_mode;    /**< current cooling mode */
 	thermal_state_t therm_state;  /**< current thermal state */
-} thermal_t;
+	int crit;                     /**< critical temperature of a hwmon sensor, NOT_SUPPORTED if unknown */
+	int max;                      /**< maximum temperature of a hwmon sensor, NOT_SUPPORTED if unknown */
+	int dir_fd;                   /**< handle of the zone directory, files are read relative to it */
+	int input_fd;                 /**< open temperature file of a hwmon sensor or sysfs zone, -1 for /proc zones, another negative value while a trace is replayed */
+	int trip_count;               /**< number of trip points */
+	acpi_trip_t trips[MAX_TRIPS]; /**< trip points, read when the zone is found */
+	unsigned long cpus[CPU_WORDS]; /**< bitmap of the CPUs the zone covers, see init_acpi_cpumap() */
+	unsigned long gen;            /**< generation of the last change */
+	unsigned long field_gen[G_ZONE_GROUPS]; /**< generation of the last change per field group */
+
+	/* interned strings, see acpi_strtab_size() */
+	const char *name;             /**< name of the thermal zone, hwmonN/tempM for hwmon */
+	const char *dir;              /**< thermal zone directory */
+	const char *state_file;       /**< state file of the zone, relative to dir */
+	const char *cooling_file;     /**< cooling mode file, relative to dir */
+	const char *freq_file;        /**< polling frequency file, relative to dir */
+	const char *trips_file;       /**< trip points file, relative to dir */
+	const char *temp_file;        /**< temperature file, relative to dir */
+	const char *chip;             /**< hwmon chip name, NULL for acpi zones */
+	const char *label;            /**< hwmon channel label or sysfs zone type, NULL if there is none */
+} ACPI_CACHE_ALIGNED thermal_t;
 
 /**
  * \struct adapter_t
  * \brief information about ac adapater
  */
 typedef struct {
-	char *name;                   /**< ac adapter name */
-	char state_file[MAX_NAME];    /**< state file for adapter + path */
 	power_state_t ac_state;       /**< current ac state, on-line or off-line */
+	supply_type_t type;           /**< kind of power source */
+	int dir_fd;                   /**< handle of the adapter directory, files are read relative to it */
+	unsigned long gen;            /**< generation of the last change */
+	unsigned long field_gen[G_AC_GROUPS]; /**< generation of the last change per field group */
+	const char *name;             /**< ac adapter name, interned */
+	const char *dir;              /**< adapter directory, interned */
+	const char *state_file;       /**< state file for adapter, relative to dir */
 } adapter_t;
 
+/**
+ * \struct powercap_t
+ * \brief powercap (RAPL) energy counter zone
+ */
+typedef struct {
+	int power;                    /**< average power between the last two reads in mW */
+	int parent;                   /**< index of the parent zone in powercaps, -1 for a top level zone */
+	int dir_fd;                   /**< handle of the zone directory, files are read relative to it */
+	unsigned long long energy;    /**< energy counted since the zone was found in uJ, corrected for wraparound */
+	unsigned long long energy_raw; /**< last value of energy_uj */
+	unsigned long long max_energy; /**< max_energy_range_uj, energy_uj wraps to 0 after it */
+	long long time;               /**< monotonic time of the last read in ns */
+	unsigned long gen;            /**< generation of the last change */
+	unsigned long field_gen[G_PCAP_GROUPS]; /**< generation of the last change per field group */
+
+	/* interned strings, see acpi_strtab_size() */
+	const char *name;             /**< zone directory name, for example intel-rapl:0:1 */
+	const char *label;            /**< contents of the name attribute, for example package-0 or dram */
+	const char *dir;              /**< zone directory */
+} ACPI_CACHE_ALIGNED powercap_t;
+
+/**
+ * \struct acpi_powercap_sample_t
+ * \brief one raw reading of a powercap energy counter
+ */
+typedef struct {
+	unsigned long long energy;    /**< value of energy_uj */
+	long long time;               /**< monotonic time of the reading in ns */
+} acpi_powercap_sample_t;
+
 /**
  * \struct global_t
  * \brief global acpi structure
@@ -177,8 +342,10 @@ typedef struct {
 	int batt_count;               /**< number of found batteries */
 	int thermal_count;            /**< number of found thermal zones */
 	int fan_count;                /**< number of found fans */
+	int adapt_count;              /**< number of found power sources */
+	int powercap_count;           /**< number of found powercap zones */
 	int temperature;              /**< system temperature if we only have on thermal zone */
-	adapter_t adapt;              /**< ac adapter */
+	adapter_t adapt;              /**< first ac adapter with the combined state of all power sources */
 	int sysstyle;
 } global_t;
 
@@ -186,17 +353,27 @@ typedef struct {
  * Array for existing batteries, loop until
  * globals->battery_count
  */
-battery_t batteries[MAX_ITEMS];
+extern battery_t batteries[MAX_ITEMS];
 /**
  * Array for existing thermal zones, loop until
  * globals->thermal_count
  */
-thermal_t thermals[MAX_ITEMS];
+extern thermal_t thermals[MAX_ITEMS];
 /**
  * Array for existing fans, loop until
  * globals->fan_count
  */
-fan_t fans[MAX_ITEMS];
+extern fan_t fans[MAX_ITEMS];
+/**
+ * Array for existing power sources (mains, USB, UPS), loop until
+ * globals->adapt_count
+ */
+extern adapter_t adapters[MAX_ITEMS];
+/**
+ * Array for existing powercap zones and subzones, loop until
+ * globals->powercap_count. Subzones follow their parent.
+ */
+extern powercap_t powercaps[MAX_ITEMS];
 /**
  * Finds existing batteries and fills the
  * corresponding batteries structures with the paths
@@ -211,10 +388,22 @@ int init_acpi_batt(global_t *globals);
  * @param globals pointer to global acpi structure
  */
 int init_acpi_acadapt(global_t *globals);
+/**
+ * Lists the power supplies once, classifies them by type and fills the
+ * batteries and adapters arrays and the combined adapter state. This is
+ * cheaper than calling init_acpi_batt() and init_acpi_acadapt(), which
+ * each do the full pass on /sys.
+ * @param globals pointer to global acpi structure
+ * @return SUCCESS if any battery or power source was found
+ */
+int init_acpi_supplies(global_t *globals);
 /**
  * Finds existing thermal zones and fills
  * corresponding thermal structures with the paths
- * of the important to parse files for thermal information
+ * of the important to parse files for thermal information.
+ * Without /proc/acpi/thermal_zone the zones of SYS_THERMAL are used,
+ * their temperature file stays open like the one of a hwmon sensor.
+ * The trip points of both kinds are read once.
  * @param globals pointer to global acpi structure
  */
 int init_acpi_thermal(global_t *globals);
@@ -225,6 +414,136 @@ int init_acpi_thermal(global_t *globals);
  * @param globals pointer to global acpi structure
  */
 int init_acpi_fan(global_t *globals);
+/**
+ * Finds the powercap zones and subzones, for example intel-rapl:0 and
+ * intel-rapl:0:0, and reads their names and counter ranges
+ * @param globals pointer to global acpi structure
+ * @param root powercap class directory, SYS_POWERCAP if NULL. Another
+ * directory can hold a fake tree for testing
+ * @return SUCCESS or NOT_SUPPORTED if there are no zones
+ */
+int init_acpi_powercap(global_t *globals, const char *root);
+/**
+ * Finds the temperature and fan channels of all hwmon chips and appends
+ * them to the thermals and fans arrays, after the acpi zones and fans.
+ * Call it after init_acpi_thermal() and init_acpi_fan(), which start the
+ * arrays over. The label, crit and max files are read once, the input
+ * file of every channel stays open and is read by read_acpi_zone() and
+ * read_acpi_fan(). Temperatures are converted to degrees Celsius.
+ * @param globals pointer to global acpi structure
+ * @param root hwmon class directory, SYS_HWMON if NULL
+ * @return SUCCESS or NOT_SUPPORTED if no channel was found
+ */
+int init_acpi_hwmon(global_t *globals, const char *root);
+/**
+ * Maps the thermal zones to the CPUs they cover, using the CPU topology.
+ * x86_pkg_temp zones cover the CPUs of one package, in the order of the
+ * package ids. coretemp channels labeled "Package id N" cover package N,
+ * channels labeled "Core N" the CPUs with that core id in the package of
+ * the chip. Other zones cover no CPU. Call it after init_acpi_thermal()
+ * and init_acpi_hwmon().
+ * @param globals pointer to global acpi structure
+ * @param root cpu directory, SYS_CPU if NULL
+ * @return SUCCESS or NOT_SUPPORTED if no zone could be mapped
+ */
+int init_acpi_cpumap(global_t *globals, const char *root);
+
+/**
+ * \struct acpi_init_result_t
+ * \brief outcome of the initialization of one device class
+ */
+typedef struct {
+	int status;                   /**< SUCCESS if devices of the class were found, negative values on errors */
+	long long ns;                 /**< time from the start of acpi_init_all() until the class was ready */
+} acpi_init_result_t;
+
+/**
+ * Initializes all device classes at once instead of calling the init
+ * functions one after another. The power supplies, thermal zones, fans
+ * and powercap zones are discovered on threads of their own, hwmon chips
+ * and the CPU map are added when the zones and fans are there. Returns
+ * when every class is ready.
+ * @param globals pointer to global acpi structure
+ * @param result filled with status and time per acpi_class_t, may be NULL.
+ * The ac adapter and batteries come from the same pass over the power
+ * supplies, zones and fans are ready together with the hwmon chips
+ * @return SUCCESS if any device was found, NOT_SUPPORTED otherwise
+ */
+int acpi_init_all(global_t *globals, acpi_init_result_t result[ACPI_CLASSES]);
+/**
+ * Writes the discovered devices with their static values into a cache
+ * file, so the next process can skip the discovery. The cache is keyed
+ * by the boot id, the online CPUs and the mtimes and number of entries of
+ * the device class directories. sysfs directory mtimes are not reliable,
+ * a device replaced by another one under the same name between two boots
+ * of the cache is not noticed. The acpi version is kept for
+ * check_acpi_support(). The file is written to a new temporary file with
+ * mode 0644 and renamed over path.
+ * @param globals pointer to global acpi structure, initialized devices
+ * @param path cache file. If NULL $XDG_RUNTIME_DIR/libacpi.cache when
+ * XDG_RUNTIME_DIR is set, ACPI_DISCOVERY_CACHE otherwise
+ * @return SUCCESS, NOT_SUPPORTED if the file cannot be written or
+ * DISABLED while a trace is recorded or replayed
+ */
+int acpi_discovery_save(global_t *globals, const char *path);
+/**
+ * Takes the devices from a cache file written by acpi_discovery_save()
+ * instead of discovering them. Only the device directories and input
+ * files are opened, the next reads are the dynamic values. The devices
+ * found before are closed.
+ * @param globals pointer to global acpi structure
+ * @param path cache file, the same default as acpi_discovery_save() if NULL
+ * @return SUCCESS, NOT_PRESENT if there is no cache, it is out of date or
+ * a device went away, BAD_FORMAT, ALLOC_ERR, NOT_SUPPORTED or DISABLED
+ * while a trace is recorded or replayed
+ */
+int acpi_discovery_load(global_t *globals, const char *path);
+/**
+ * Loads the devices from the discovery cache, if that fails discovers
+ * them with acpi_init_all() and writes the cache
+ * @param globals pointer to global acpi structure
+ * @param path cache file, the same default as acpi_discovery_save() if NULL
+ * @return SUCCESS if any device was found, NOT_SUPPORTED otherwise
+ */
+int acpi_init_cached(global_t *globals, const char *path);
+
+/**
+ * Closes the directory handles held for all devices. The devices have to
+ * be initialized again before they can be read.
+ * @param globals pointer to global acpi structure
+ */
+void close_acpi(global_t *globals);
+
+/**
+ * Starts recording every attribute read and directory listing the
+ * library does, with the returned bytes and the latency, into a trace file
+ * @param file trace file to write
+ * @return SUCCESS or NOT_SUPPORTED if the file cannot be created
+ */
+int acpi_trace_record(const char *file);
+/**
+ * Answers all attribute reads and directory listings from a recorded
+ * trace instead of the file system. Reads of the same file get the
+ * recorded responses in order, starting over when they are used up.
+ * Devices found while replaying have no open handles, their inputs are
+ * read by name.
+ * @param file trace file written by acpi_trace_record()
+ * @param timing if non-zero every response is delayed by its recorded latency
+ * @return SUCCESS, NOT_SUPPORTED, ALLOC_ERR or BAD_FORMAT
+ */
+int acpi_trace_replay(const char *file, const int timing);
+/**
+ * Stops recording or replaying, flushes and frees the trace
+ */
+void acpi_trace_stop(void);
+
+/**
+ * Returns how much of the interned string table holding device names
+ * and paths is used. Strings are deduplicated, re-initializing devices
+ * with the same names does not grow the table.
+ * @return used bytes, at most STRTAB_SIZE
+ */
+size_t acpi_strtab_size(void);
 
 /**
  * Checks if the system does support ACPI or not
@@ -236,8 +555,18 @@ int check_acpi_support(void);
  * Gathers all information of a given battery and filling
  * a struct with it
  * @param num number of battery
+ * @return SUCCESS, STALE if a read missed its deadline, or negative values on errors
  */
 int read_acpi_batt(const int num);
+/**
+ * Refreshes a copy of a battery like read_acpi_batt(), without touching
+ * batteries[], so the slow reads need no lock. Registered attributes are
+ * not read.
+ * @param num number of battery
+ * @param info copy of batteries[num] to refresh
+ * @return SUCCESS, STALE if a read missed its deadline, or negative values on errors
+ */
+int read_acpi_batt_copy(const int num, battery_t *info);
 /**
  * Looks up if the ac adapter is plugged in or not
  * and sets the values in a struct
@@ -250,12 +579,753 @@ void read_acpi_acstate(global_t *globals);
  * and sets the corresponding values in a struct
  * @param num zone
  * @param globals pointer to global acpi struct, needed if there is just one zone
+ * @return SUCCESS, STALE if a read missed its deadline, or negative values on errors
  */
 int read_acpi_zone(const int num, global_t *globals);
+/**
+ * Refreshes a copy of a thermal zone like read_acpi_zone(), without
+ * touching thermals[] or the global temperature. The reading still goes
+ * into the forecast history. Registered attributes are not read.
+ * @param num zone
+ * @param info copy of thermals[num] to refresh
+ * @return SUCCESS, STALE if a read missed its deadline, or negative values on errors
+ */
+int read_acpi_zone_copy(const int num, thermal_t *info);
 /**
  * Gathers all information about given fan
  * and sets the corresponding values in a struct
  * @param num number for the fan to read
+ * @return SUCCESS, STALE if a read missed its deadline, or negative values on errors
  */
 int read_acpi_fan(const int num);
+/**
+ * Reads the energy counter of a powercap zone, adds the consumption since
+ * the last read to energy and updates the average power
+ * @param num number of the zone
+ * @return SUCCESS, STALE if the read missed its deadline or NOT_SUPPORTED
+ * if energy_uj cannot be read, it is only readable by root on recent kernels
+ */
+int read_acpi_powercap(const int num);
+/**
+ * Takes a raw reading of the energy counter of a powercap zone without
+ * changing the zone record
+ * @param num number of the zone
+ * @param sample filled with the counter and the time
+ * @return SUCCESS, ITEM_EXCEED or NOT_SUPPORTED
+ */
+int acpi_powercap_sample(const int num, acpi_powercap_sample_t *sample);
+/**
+ * Computes the average power between two readings of a zone, taking a
+ * wraparound of the counter at max_energy into account
+ * @param num number of the zone
+ * @param from earlier reading
+ * @param to later reading
+ * @return power in mW, NOT_SUPPORTED if the readings are not in order
+ */
+int acpi_powercap_power(const int num, const acpi_powercap_sample_t *from, const acpi_powercap_sample_t *to);
+
+#define FORECAST_SAMPLES 16
+
+/**
+ * \struct acpi_forecast_t
+ * \brief temperature trend of a thermal zone, see acpi_zone_forecast()
+ */
+typedef struct {
+	int temperature;              /**< smoothed current temperature in millidegrees Celsius */
+	int slope;                    /**< trend in millidegrees per second */
+	int limit;                    /**< temperature the zone settles at in millidegrees, NOT_SUPPORTED if it does not level off */
+	int trip;                     /**< index in trips of the trip point the forecast is for */
+	int seconds;                  /**< estimated seconds until the trip point is reached, 0 if it is, NOT_SUPPORTED if the zone is not heading there or not within INT_MAX seconds */
+} acpi_forecast_t;
+
+/**
+ * Estimates when a thermal zone reaches its next passive, hot or critical
+ * trip point from its last FORECAST_SAMPLES refreshes, so load can be
+ * shed before the hardware throttles. The trend is a least squares line.
+ * If the rate of rise falls off as the zone heats up, a first order model
+ * is fitted and the time comes from the temperature it settles at. The
+ * history starts over when the zones are initialized. While the sampler
+ * runs call it between acpi_sampler_lock() and acpi_sampler_unlock().
+ * @param num number of the zone
+ * @param forecast filled with the estimate
+ * @return SUCCESS, ITEM_EXCEED or NOT_SUPPORTED if the zone has no trip
+ * points or fewer than three readings at different times
+ */
+int acpi_zone_forecast(const int num, acpi_forecast_t *forecast);
+
+/**
+ * \struct acpi_cpu_headroom_t
+ * \brief thermal headroom of a CPU, see acpi_coolest_cpus()
+ */
+typedef struct {
+	int cpu;                      /**< CPU number */
+	int headroom;                 /**< degrees below the nearest passive, hot or critical trip point, negative above it */
+	int zone;                     /**< index of the zone in thermals that limits the CPU */
+} acpi_cpu_headroom_t;
+
+/**
+ * Ranks the CPUs by thermal headroom, the CPU furthest below a trip point
+ * first. A CPU covered by several zones gets the smallest headroom of
+ * them. Active trip points only switch on fans and are not counted. The
+ * last read temperatures are used, nothing is read from the hardware.
+ * @param globals pointer to global acpi structure
+ * @param cpus filled with the ranking
+ * @param n room in cpus
+ * @return number of ranked CPUs, at most n. CPUs without a mapped zone
+ * with trip points are left out
+ */
+int acpi_coolest_cpus(global_t *globals, acpi_cpu_headroom_t *cpus, const int n);
+
+/**
+ * \struct acpi_batch_t
+ * \brief columns of raw battery samples and their derived values
+ *
+ * Row i of every column belongs to the same sample. Output columns which
+ * are NULL are not computed.
+ */
+typedef struct {
+	size_t rows;                  /**< number of samples */
+	const int *remaining_cap;     /**< remaining capacity, required */
+	const int *last_full_cap;     /**< last full capacity, required */
+	const int *present_rate;      /**< present rate, for charge_time and remaining_time */
+	const int *charge_state;      /**< charge_state_t, for charge_time and remaining_time */
+	const int *design_warn;       /**< design capacity warning, for batt_state */
+	const int *design_low;        /**< design capacity low, for batt_state */
+	int *percentage;              /**< output, remaining battery percentage */
+	int *charge_time;             /**< output, minutes until charged */
+	int *remaining_time;          /**< output, minutes until empty */
+	int *batt_state;              /**< output, batt_state_t */
+} acpi_batch_t;
+
+/**
+ * Computes percentage, charge time, remaining time and battery state for
+ * columns of archived samples. The results are bit-identical to the
+ * values read_acpi_batt() computes for the same raw values.
+ * @param batch input and output columns
+ * @return SUCCESS or NOT_SUPPORTED if an input needed for a requested output is missing
+ */
+int acpi_batch_calc(acpi_batch_t *batch);
+
+/**
+ * \struct acpi_change_t
+ * \brief change iterator state and result
+ *
+ * Set since to the generation seen last and pos to 0, then call
+ * acpi_changes() until it stops returning SUCCESS.
+ */
+typedef struct {
+	unsigned long since;          /**< caller held generation */
+	int pos;                      /**< iterator position, 0 to start */
+	acpi_class_t dev_class;       /**< class of the changed device */
+	int num;                      /**< number of the changed device */
+	int field;                    /**< changed field group, G_* of the class */
+	unsigned long gen;            /**< generation of the change */
+} acpi_change_t;
+
+/**
+ * Returns the current generation. Every refresh that changes a value
+ * bumps the generation and stores it in the device and field group.
+ * @return current generation, 0 before anything was read
+ */
+unsigned long acpi_generation(void);
+/**
+ * Yields the next field group that changed after change->since
+ * @param globals pointer to global acpi structure
+ * @param change iterator state, filled with the changed field
+ * @return SUCCESS if a change was found, NOT_PRESENT when done
+ */
+int acpi_changes(global_t *globals, acpi_change_t *change);
+
+/**
+ * \enum acpid_event_type_t
+ * \brief kind of an acpid event
+ */
+typedef enum {
+	EV_LID,                       /**< lid opened or closed */
+	EV_POWER_BUTTON,              /**< power button pressed */
+	EV_SLEEP_BUTTON,              /**< sleep button pressed */
+	EV_AC,                        /**< ac adapter plugged or unplugged */
+	EV_BATTERY,                   /**< battery status changed, inserted or removed */
+	EV_THERMAL,                   /**< thermal zone notification */
+	EV_OTHER                      /**< anything else, see device_class */
+} acpid_event_type_t;
+
+/**
+ * \struct acpid_event_t
+ * \brief event read from acpid or /proc/acpi/event
+ */
+typedef struct {
+	acpid_event_type_t type;      /**< kind of the event */
+	int value;                    /**< 1 open, 0 closed for EV_LID, P_AC or P_BATT for EV_AC, data for EV_BATTERY and EV_THERMAL, else NOT_SUPPORTED */
+	int num;                      /**< refreshed battery for EV_BATTERY, 0 for EV_AC, -1 if no single device was refreshed */
+	unsigned int code;            /**< event type as sent, 0 for events with a text action */
+	unsigned int data;            /**< event data as sent */
+	char device_class[32];        /**< device class as sent, for example button/lid */
+	char bus_id[32];              /**< bus id as sent, for example PNP0C0A:00 */
+} acpid_event_t;
+
+/**
+ * Connects to the event stream of acpid, or opens /proc/acpi/event if
+ * acpid does not run. Poll the returned descriptor for input and call
+ * acpi_acpid_read() until it returns NOT_PRESENT.
+ * @param path unix socket or file to read events from, NULL for
+ * ACPID_SOCKET and then /proc/acpi/event
+ * @return non-blocking descriptor or NOT_SUPPORTED
+ */
+int acpi_acpid_open(const char *path);
+/**
+ * Takes the next event and refreshes the devices it is about: the ac
+ * state for EV_AC, the battery with a matching bus id, or all batteries,
+ * for EV_BATTERY. The refresh takes the sampler lock, do not hold it.
+ * @param globals pointer to global acpi structure, initialized devices
+ * @param event filled with the event
+ * @return SUCCESS, NOT_PRESENT if no complete event is pending or
+ * NOT_SUPPORTED if the stream is not open or was closed by acpid
+ */
+int acpi_acpid_read(global_t *globals, acpid_event_t *event);
+/**
+ * Closes the event stream
+ */
+void acpi_acpid_close(void);
+
+#define COOL_LOOPS 4
+#define COOL_CDEVS 8
+#define COOL_CURVE_POINTS 8
+
+/**
+ * \enum acpi_cool_policy_t
+ * \brief how a cooling loop picks the cooling level
+ */
+typedef enum {
+	COOL_PID,                     /**< PID controller around a target temperature */
+	COOL_CURVE                    /**< piecewise linear curve of temperature to level */
+} acpi_cool_policy_t;
+
+/**
+ * \struct acpi_cool_config_t
+ * \brief configuration of a cooling loop
+ *
+ * Levels are in per mille of max_state of each cooling device.
+ */
+typedef struct {
+	int zone;                     /**< index of a sysfs zone in thermals */
+	const char *zone_dir;         /**< zone directory to drive instead of zone, NULL for zone. For fixture trees, temp is read from it directly */
+	acpi_cool_policy_t policy;    /**< PID or curve */
+	int target;                   /**< COOL_PID: temperature to hold in degrees Celsius */
+	double kp;                    /**< COOL_PID: level per degree above target */
+	double ki;                    /**< COOL_PID: level per degree second */
+	double kd;                    /**< COOL_PID: level per degree per second */
+	int curve_points;             /**< COOL_CURVE: points used, 1 to COOL_CURVE_POINTS */
+	int curve_temp[COOL_CURVE_POINTS];  /**< COOL_CURVE: temperatures in ascending order */
+	int curve_level[COOL_CURVE_POINTS]; /**< COOL_CURVE: level at each temperature */
+	int period_ms;                /**< minimum time between two writes */
+	int take_over;                /**< set the zone mode to disabled, so the kernel governor leaves the devices alone, see acpi_cool_start() */
+} acpi_cool_config_t;
+
+/**
+ * \struct acpi_cool_status_t
+ * \brief state of a cooling loop
+ */
+typedef struct {
+	int temperature;              /**< last read temperature of the zone */
+	int level;                    /**< last computed level in per mille */
+	int devices;                  /**< number of driven cooling devices */
+	int take_over;                /**< the zone mode was set to disabled */
+	unsigned long writes;         /**< cur_state writes so far */
+	int state[COOL_CDEVS];        /**< last written cur_state of each device */
+} acpi_cool_status_t;
+
+/**
+ * Starts a cooling loop for a thermal zone of /sys/class/thermal. It
+ * drives all cooling devices the zone links to (cdevN). Nothing is
+ * written before acpi_cool_step() is called. The first started loop
+ * registers acpi_cool_stop() with atexit().
+ *
+ * WARNING: with take_over the kernel governor of the zone stays disabled
+ * until acpi_cool_stop() runs. exit() and returning from main() run it,
+ * a fatal signal, _exit() or a crash do not and leave the zone without
+ * any thermal control. Handle SIGTERM, SIGINT and SIGHUP by calling
+ * exit() from the main loop once the signal was seen, and restore
+ * "enabled" in the zone mode file from a service manager stop hook.
+ * @param globals pointer to global acpi structure, initialized zones
+ * @param config loop configuration, copied
+ * @return number of the loop, ITEM_EXCEED if COOL_LOOPS run or the zone
+ * does not exist, DISABLED if the zone already has a loop or
+ * NOT_SUPPORTED if it has no writable cooling device
+ */
+int acpi_cool_start(global_t *globals, const acpi_cool_config_t *config);
+/**
+ * Reads the zone of every loop, computes the levels and writes the
+ * changed cur_state values of all loops in one pass. A loop writes at
+ * most once per period_ms. The read takes the sampler lock, do not hold it.
+ * @param globals pointer to global acpi structure
+ * @return number of written cur_state values
+ */
+int acpi_cool_step(global_t *globals);
+/**
+ * Stops all loops and writes back the cur_state values and zone modes
+ * found at their start
+ */
+void acpi_cool_stop(void);
+/**
+ * Copies the state of a cooling loop
+ * @param loop number returned by acpi_cool_start()
+ * @param status filled with the state
+ * @return SUCCESS or ITEM_EXCEED
+ */
+int acpi_cool_status(const int loop, acpi_cool_status_t *status);
+
+#define MAX_ATTRS 16
+#define ATTR_STRLEN 32
+
+/**
+ * \enum acpi_attr_type_t
+ * \brief how the contents of an extra attribute are interpreted
+ */
+typedef enum {
+	ATTR_INT,                     /**< decimal number, for example cycle_count */
+	ATTR_ENUM,                    /**< one of a list of strings, for example capacity_level */
+	ATTR_STRING                   /**< text, for example manufacturer */
+} acpi_attr_type_t;
+
+/**
+ * \enum acpi_attr_refresh_t
+ * \brief when an extra attribute is read
+ */
+typedef enum {
+	ATTR_STATIC,                  /**< once, on the first refresh after the device was found */
+	ATTR_DYNAMIC                  /**< on every refresh of the device */
+} acpi_attr_refresh_t;
+
+/**
+ * \struct acpi_attr_value_t
+ * \brief last value of an extra attribute of a device
+ */
+typedef struct {
+	int status;                   /**< SUCCESS or NOT_SUPPORTED if the device does not have the attribute */
+	int value;                    /**< the number for ATTR_INT, the index in values for ATTR_ENUM or NOT_SUPPORTED if it is not listed */
+	char string[ATTR_STRLEN];     /**< contents of the attribute, cut to ATTR_STRLEN - 1 characters */
+} acpi_attr_value_t;
+
+/**
+ * Registers an extra attribute of a device class, for example
+ * cycle_count or health of the batteries. It is read from the directory
+ * of every device of the class through its open handle, during the
+ * refresh functions read_acpi_batt(), read_acpi_zone(), read_acpi_fan(),
+ * read_acpi_acstate() and read_acpi_powercap(). Register attributes
+ * before the sampler or cache is started. Devices found in /proc do not
+ * have sysfs attributes and report NOT_SUPPORTED.
+ * @param dev_class class of the devices
+ * @param name attribute file, relative to the device directory
+ * @param type how the contents are interpreted
+ * @param refresh whether the attribute is read once or on every refresh
+ * @param values NULL terminated list of the strings of an ATTR_ENUM, it
+ * has to stay valid. NULL for the other types
+ * @return id of the attribute, the same id if it is already registered,
+ * ITEM_EXCEED if MAX_ATTRS are registered or NOT_SUPPORTED for a bad name
+ */
+int acpi_attr_register(const acpi_class_t dev_class, const char *name, const acpi_attr_type_t type,
+		const acpi_attr_refresh_t refresh, const char * const *values);
+/**
+ * Copies the last read value of an extra attribute of a device
+ * @param dev_class class of the device
+ * @param num number of the device
+ * @param id id returned by acpi_attr_register()
+ * @param value filled with the value
+ * @return SUCCESS, NOT_SUPPORTED if the attribute was not read from the
+ * device or belongs to another class, or ITEM_EXCEED
+ */
+int acpi_attr_get(const acpi_class_t dev_class, const int num, const int id, acpi_attr_value_t *value);
+/**
+ * Forgets all registered extra attributes
+ */
+void acpi_attr_clear(void);
+
+/**
+ * \struct acpi_event_t
+ * \brief state transition reported by the sampler
+ *
+ * Events are sent for changes of the ac state, of charge_state, of
+ * batt_state when it crosses B_LOW or B_CRIT and of therm_state.
+ */
+typedef struct {
+	acpi_class_t dev_class;       /**< class of the device */
+	int num;                      /**< number of the device, 0 for the ac adapter */
+	int field;                    /**< changed field group, G_* of the class */
+	int old_value;                /**< previous value of the field */
+	int new_value;                /**< current value of the field */
+	unsigned long gen;            /**< generation of the change */
+} acpi_event_t;
+
+/**
+ * Callback for sampler events, runs on the dispatcher thread
+ * @param event the transition, only valid during the call
+ * @param arg pointer given to acpi_sampler_register()
+ */
+typedef void (*acpi_event_cb)(const acpi_event_t *event, void *arg);
+
+#define SAMPLER_CALLBACKS 8
+#define SAMPLER_QUEUE 256
+
+/**
+ * Registers a callback for sampler events. Callbacks have to be
+ * registered before acpi_sampler_start().
+ * @param cb function to call for each event
+ * @param arg passed to cb
+ * @return SUCCESS or ITEM_EXCEED if SAMPLER_CALLBACKS are registered
+ */
+int acpi_sampler_register(acpi_event_cb cb, void *arg);
+/**
+ * Starts the sampler thread. It refreshes every device class on its own
+ * timer and queues the transitions for a second thread which invokes
+ * the callbacks, so a slow callback never delays a read. While the
+ * sampler runs the devices and globals must only be accessed between
+ * acpi_sampler_lock() and acpi_sampler_unlock().
+ * @param globals pointer to global acpi structure, initialized devices
+ * @param period refresh period in ms per acpi_class_t, 0 to not refresh a class
+ * @return SUCCESS, NOT_SUPPORTED if the timers or threads cannot be created
+ * or DISABLED if the sampler is already running
+ */
+int acpi_sampler_start(global_t *globals, const int period[ACPI_CLASSES]);
+/**
+ * Stops the sampler, delivers the events still queued and forgets the
+ * registered callbacks
+ */
+void acpi_sampler_stop(void);
+/**
+ * Waits until the sampler finished the current refresh and keeps it from
+ * starting a new one
+ */
+void acpi_sampler_lock(void);
+/**
+ * Lets the sampler refresh again
+ */
+void acpi_sampler_unlock(void);
+/**
+ * Returns the number of events dropped because the queue was full
+ * @return dropped events since acpi_sampler_start()
+ */
+unsigned long acpi_sampler_dropped(void);
+
+/**
+ * Starts the battery and thermal zone cache. acpi_cache_batt() and
+ * acpi_cache_zone() return the last values without waiting for the
+ * hardware, a worker thread refreshes devices older than max_age_ms in
+ * the background. Requests for a device that is already being refreshed
+ * do not cause another read. The cache starts with the values the devices
+ * hold now, with a timestamp of 0. The copy takes the sampler lock, do
+ * not hold it.
+ * @param globals pointer to global acpi structure, initialized devices
+ * @param max_age_ms age after which a device is refreshed
+ * @return SUCCESS, NOT_SUPPORTED if the thread cannot be created or
+ * DISABLED if the cache is already running
+ */
+int acpi_cache_start(global_t *globals, const int max_age_ms);
+/**
+ * Stops the cache worker after the refresh it is doing
+ */
+void acpi_cache_stop(void);
+/**
+ * Copies the cached values of a battery and requests a background
+ * refresh if they are older than the max age
+ * @param num number of the battery
+ * @param batt filled with the cached values
+ * @param stamp set to the monotonic time of the last refresh in ns, may be NULL
+ * @return SUCCESS, ITEM_EXCEED or DISABLED if the cache is not running
+ */
+int acpi_cache_batt(const int num, battery_t *batt, long long *stamp);
+/**
+ * Copies the cached values of a thermal zone, see acpi_cache_batt()
+ * @param num number of the zone
+ * @param zone filled with the cached values
+ * @param stamp set to the monotonic time of the last refresh in ns, may be NULL
+ * @return SUCCESS, ITEM_EXCEED or DISABLED if the cache is not running
+ */
+int acpi_cache_zone(const int num, thermal_t *zone, long long *stamp);
+/**
+ * Returns the number of background refreshes since acpi_cache_start()
+ * @return refreshes done
+ */
+unsigned long acpi_cache_refreshes(void);
+
+#define DEADLINE_READERS 4
+#define DEADLINE_SLOTS 128
+
+/**
+ * Bounds how long refreshes block on slow firmware. With a deadline set
+ * attributes are read on one of DEADLINE_READERS threads. A read which
+ * misses its deadline is left to finish there and the last good content
+ * of the attribute is used instead, the refresh returns STALE. Once a
+ * refresh has used up refresh_ms its remaining attributes are not read
+ * at all. No second read of an attribute is started while one is pending.
+ * The last good content of DEADLINE_SLOTS attributes is kept, the one
+ * used longest ago makes room for a new one; close_acpi() forgets all.
+ * @param attr_ms deadline of a single attribute read, 0 for none
+ * @param refresh_ms deadline of a whole device refresh, 0 for none
+ * @return SUCCESS or NOT_SUPPORTED for negative deadlines
+ */
+int acpi_deadline_set(const int attr_ms, const int refresh_ms);
+/**
+ * Tells if the last refresh on the calling thread used last good content,
+ * for read_acpi_acstate() which has no return value
+ * @return 1 if it did, 0 otherwise
+ */
+int acpi_deadline_stale(void);
+/**
+ * Returns the number of reads which missed their deadline
+ * @return missed reads since the library was loaded
+ */
+unsigned long acpi_deadline_misses(void);
+
+#define BACKOFF_SLOTS 128
+
+/**
+ * \struct acpi_quarantine_t
+ * \brief an attribute file which failed on its last reads
+ */
+typedef struct {
+	const char *dir;         /**< directory of the device */
+	const char *attr;        /**< name of the attribute */
+	int failures;            /**< consecutive failed reads */
+	unsigned long skipped;   /**< reads skipped since the first failure */
+	int retry_ms;            /**< time until the attribute is tried again */
+	int quarantined;         /**< 1 if it is only retried every max_ms */
+} acpi_quarantine_t;
+
+/**
+ * Backs off attribute files which fail during refreshes. After n
+ * consecutive failures an attribute is not read for base_ms * 2^(n - 1),
+ * at most max_ms, jittered by up to half of that; reads skipped meanwhile
+ * fail like the file was missing. A read missing its deadline, or started
+ * while an earlier one still hangs, counts as a failure. A successful
+ * read forgets the failures. Reads outside of refreshes, e.g. while
+ * devices are initialized, are never skipped.
+ * @param base_ms delay after the first failure, 0 turns the backoff off
+ * @param max_ms longest delay, the retry period of quarantined attributes
+ * @return SUCCESS or NOT_SUPPORTED if the delays are negative or max_ms < base_ms
+ */
+int acpi_backoff_set(const int base_ms, const int max_ms);
+/**
+ * Forgets the failures of a device so its attributes are read on the
+ * next refresh, for example after a battery was inserted
+ * @param dir directory of the device, NULL for all devices
+ */
+void acpi_backoff_reset(const char *dir);
+/**
+ * Lists the attributes backed off after failed reads
+ * @param list filled with up to n attributes
+ * @param n room in list
+ * @return number of attributes in list
+ */
+int acpi_quarantine(acpi_quarantine_t *list, const int n);
+
+#define POWER_RING 4096
+
+/**
+ * \struct acpi_power_sample_t
+ * \brief one reading of the high rate power sampler
+ */
+typedef struct {
+	long long ns;                 /**< monotonic time of the reading in ns */
+	long long power;              /**< power draw in uW */
+	unsigned long long energy;    /**< energy counter after the reading in nJ */
+} acpi_power_sample_t;
+
+/**
+ * \struct acpi_power_mark_t
+ * \brief position in the energy counter, see acpi_power_mark()
+ */
+typedef struct {
+	long long ns;                 /**< monotonic time of the marker in ns */
+	unsigned long long energy;    /**< energy counter at the marker in nJ */
+} acpi_power_mark_t;
+
+/**
+ * Starts reading the power draw of a battery at a fixed rate on a
+ * thread of its own. power_now is used if the battery has it, otherwise
+ * current_now and voltage_now. The files are opened once, the readings
+ * are integrated into the energy counter and queued for acpi_power_read().
+ * Only batteries found on /sys can be sampled.
+ * @param num number of the battery
+ * @param period_us time between two readings in us
+ * @return SUCCESS, NOT_SUPPORTED, ITEM_EXCEED if num is no discovered
+ * battery or DISABLED if already running
+ */
+int acpi_power_start(const int num, const int period_us);
+/**
+ * Stops the power sampler, the energy counter keeps its value
+ */
+void acpi_power_stop(void);
+/**
+ * Takes the oldest readings out of the sampler queue
+ * @param samples buffer for the readings
+ * @param n size of samples
+ * @return number of readings stored
+ */
+size_t acpi_power_read(acpi_power_sample_t *samples, const size_t n);
+/**
+ * Returns the number of readings dropped because the queue was full
+ * @return dropped readings since acpi_power_start()
+ */
+unsigned long acpi_power_dropped(void);
+/**
+ * Returns the energy counter, it never decreases
+ * @return energy consumed while sampling in uWh
+ */
+unsigned long long acpi_power_energy(void);
+/**
+ * Remembers the current time and energy counter, for example at the
+ * start and end of a benchmark phase
+ * @param mark filled with the current position
+ */
+void acpi_power_mark(acpi_power_mark_t *mark);
+/**
+ * Computes the energy consumed between two markers
+ * @param from earlier marker
+ * @param to later marker
+ * @return energy in uWh, the markers hold nJ for finer resolution
+ */
+unsigned long long acpi_power_between(const acpi_power_mark_t *from, const acpi_power_mark_t *to);
+
+/**
+ * Precomputes the OpenMetrics names and labels of all devices found by
+ * the init_acpi_* functions. Call it again after devices were re-initialized.
+ * @param globals pointer to global acpi structure
+ * @return SUCCESS, ITEM_EXCEED or BUF_EXCEED if the names are too long
+ */
+int acpi_metrics_prepare(global_t *globals);
+/**
+ * Writes the values of all devices as OpenMetrics text, terminated by
+ * "# EOF". The values are not refreshed, call the read_acpi_* functions first.
+ * Samples whose value is NOT_SUPPORTED, e.g. the critical temperature of
+ * an acpi zone or the power of a powercap zone before its second read,
+ * are left out.
+ * @param buf buffer to write into, not NUL terminated
+ * @param size size of buf
+ * @return number of bytes written or BUF_EXCEED
+ */
+int acpi_metrics_render(char *buf, size_t size);
+/**
+ * Returns the buffer size acpi_metrics_render() needs at most for the
+ * devices of the last acpi_metrics_prepare()
+ * @return size in bytes
+ */
+size_t acpi_metrics_size(void);
+
+/**
+ * \enum snapshot value layout
+ * \brief position of a value inside a snapshot record
+ *
+ * A record starts with SNAP_AC_STATE, followed by SNAP_BATT_VALUES
+ * values for every battery, SNAP_ZONE_VALUES for every thermal zone,
+ * SNAP_FAN_VALUES for every fan and SNAP_PCAP_VALUES for every powercap zone.
+ */
+enum {
+	SNAP_AC_STATE,                /**< ac_state of the adapter */
+	SNAP_GLOBAL_VALUES
+};
+
+enum {
+	SNAP_BATT_PRESENT,            /**< battery_t present */
+	SNAP_BATT_REMAINING_CAP,      /**< battery_t remaining_cap */
+	SNAP_BATT_LAST_FULL_CAP,      /**< battery_t last_full_cap */
+	SNAP_BATT_PRESENT_RATE,       /**< battery_t present_rate */
+	SNAP_BATT_PRESENT_VOLTAGE,    /**< battery_t present_voltage */
+	SNAP_BATT_PERCENTAGE,         /**< battery_t percentage */
+	SNAP_BATT_CHARGE_TIME,        /**< battery_t charge_time */
+	SNAP_BATT_REMAINING_TIME,     /**< battery_t remaining_time */
+	SNAP_BATT_CHARGE_STATE,       /**< battery_t charge_state */
+	SNAP_BATT_STATE,              /**< battery_t batt_state */
+	SNAP_BATT_ALARM,              /**< battery_t alarm */
+	SNAP_BATT_VALUES
+};
+
+enum {
+	SNAP_ZONE_TEMPERATURE,        /**< thermal_t temperature */
+	SNAP_ZONE_FREQUENCY,          /**< thermal_t frequency */
+	SNAP_ZONE_MODE,               /**< thermal_t therm_mode */
+	SNAP_ZONE_STATE,              /**< thermal_t therm_state */
+	SNAP_ZONE_VALUES
+};
+
+enum {
+	SNAP_FAN_STATE,               /**< fan_t fan_state */
+	SNAP_FAN_RPM,                 /**< fan_t rpm */
+	SNAP_FAN_VALUES
+};
+
+enum {
+	SNAP_PCAP_POWER,              /**< powercap_t power */
+	SNAP_PCAP_VALUES
+};
+
+#define SNAP_VERSION 1
+#define SNAP_MAX_VALUES (SNAP_GLOBAL_VALUES + MAX_ITEMS * \
+	(SNAP_BATT_VALUES + SNAP_ZONE_VALUES + SNAP_FAN_VALUES + SNAP_PCAP_VALUES))
+
+/**
+ * \struct acpi_snap_t
+ * \brief snapshot encoder/decoder state
+ *
+ * The stream consists of a header with a device name dictionary followed
+ * by records. Each record holds the timestamp delta, a bitmap of the
+ * values which changed since the previous record and the zigzag varint
+ * deltas of those values. Neither encoding nor decoding allocates memory.
+ */
+typedef struct {
+	unsigned char *buf;           /**< caller supplied buffer (encoder) */
+	const unsigned char *data;    /**< caller supplied buffer (decoder) */
+	size_t size;                  /**< size of buf or data */
+	size_t pos;                   /**< bytes written or read so far */
+	size_t names;                 /**< offset of the name dictionary */
+	int batt_count;               /**< number of batteries in the stream */
+	int thermal_count;            /**< number of thermal zones in the stream */
+	int fan_count;                /**< number of fans in the stream */
+	int powercap_count;           /**< number of powercap zones in the stream */
+	int count;                    /**< number of values per record */
+	long time;                    /**< timestamp of the last record */
+	int values[SNAP_MAX_VALUES];  /**< values of the last record */
+} acpi_snap_t;
+
+/**
+ * Starts a new snapshot stream in buf and writes the header with the
+ * names of all devices currently known
+ * @param snap encoder state
+ * @param globals pointer to global acpi structure
+ * @param buf buffer to write into
+ * @param size size of buf
+ * @return SUCCESS or BUF_EXCEED if the header does not fit
+ */
+int acpi_snap_begin(acpi_snap_t *snap, global_t *globals, unsigned char *buf, size_t size);
+/**
+ * Appends the current state of all devices as a record
+ * @param snap encoder state
+ * @param globals pointer to global acpi structure
+ * @param timestamp time of the sample in a unit chosen by the caller
+ * @return SUCCESS or BUF_EXCEED, in which case nothing was written
+ */
+int acpi_snap_append(acpi_snap_t *snap, global_t *globals, long timestamp);
+/**
+ * Opens a snapshot stream for reading
+ * @param snap decoder state
+ * @param data stream written by acpi_snap_begin() and acpi_snap_append()
+ * @param size length of the stream
+ * @return SUCCESS or BAD_FORMAT
+ */
+int acpi_snap_open(acpi_snap_t *snap, const unsigned char *data, size_t size);
+/**
+ * Decodes the next record into snap->time and snap->values
+ * @param snap decoder state
+ * @return SUCCESS, NOT_PRESENT at the end of the stream or BAD_FORMAT
+ */
+int acpi_snap_next(acpi_snap_t *snap);
+/**
+ * Looks up a device name in the dictionary of an opened stream. Devices
+ * are numbered batteries first, then thermal zones, fans and powercap zones.
+ * @param snap decoder state
+ * @param dev device number
+ * @param len set to the length of the name, it is not NUL terminated
+ * @return pointer into the stream or NULL if dev is out of range
+ */
+const char *acpi_snap_name(const acpi_snap_t *snap, int dev, size_t *len);
 #endif /* !__LIBACPI_H__ */
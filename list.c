@@ -13,7 +13,7 @@
 #include "list.h"
 
 /* create a new list */
-static list_t *
+list_t *
 new_list(void){
 	list_t *l = malloc(sizeof(list_t));
 	if(!l) return NULL;
@@ -22,7 +22,8 @@ new_list(void){
 	return l;
 }
 
-static void
+/* append a copy of name to the list */
+void
 append_node(list_t *lst, char *name){
 	node_t *n;
 	if(!lst) return;
@@ -27,6 +27,19 @@ typedef struct{
 	node_t *last;       /**< pointer to last node */
 } list_t;
 
+/**
+ * Creates an empty list
+ * @return new list or NULL on allocation failure
+ */
+list_t *new_list(void);
+
+/**
+ * Appends a copy of name to a list
+ * @param lst list to append to
+ * @param name name of the new node
+ */
+void append_node(list_t *lst, char *name);
+
 /**
  * Lists contents (for libacpi directories) of a directory
  * and return them in a linked list
@@ -0,0 +1,245 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * OpenMetrics text exposition of the current acpi state
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libacpi.h"
+
+#define METRICS_FAMILIES (1 + 11 + 5 + 2 + 1)
+#define METRICS_LINES (METRICS_FAMILIES + MAX_ITEMS * (METRICS_FAMILIES - 1) + 1)
+#define METRICS_TEXT (METRICS_LINES * 256)
+
+/* a sample line: precomputed text up to the value and the value source.
+ * Family headers have no value. Samples whose value is NOT_SUPPORTED are
+ * left out, the device does not have it or it was not read yet */
+typedef struct {
+	const char *prefix;
+	size_t len;
+	const int *value;
+} metric_line_t;
+
+typedef struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} metric_family_t;
+
+static const metric_family_t
+batt_families[] = {
+	{ "acpi_battery_present", "Battery slot is used", offsetof(battery_t, present) },
+	{ "acpi_battery_design_capacity", "Design capacity", offsetof(battery_t, design_cap) },
+	{ "acpi_battery_last_full_capacity", "Capacity at the last full charge", offsetof(battery_t, last_full_cap) },
+	{ "acpi_battery_remaining_capacity", "Remaining capacity", offsetof(battery_t, remaining_cap) },
+	{ "acpi_battery_present_rate", "Present charge or discharge rate", offsetof(battery_t, present_rate) },
+	{ "acpi_battery_present_voltage", "Present voltage", offsetof(battery_t, present_voltage) },
+	{ "acpi_battery_percentage", "Remaining battery percentage", offsetof(battery_t, percentage) },
+	{ "acpi_battery_charge_time_minutes", "Remaining time to full charge", offsetof(battery_t, charge_time) },
+	{ "acpi_battery_remaining_time_minutes", "Remaining battery life time", offsetof(battery_t, remaining_time) },
+	{ "acpi_battery_charge_state", "charge_state_t of the battery", offsetof(battery_t, charge_state) },
+	{ "acpi_battery_state", "batt_state_t of the battery", offsetof(battery_t, batt_state) },
+	{ NULL, NULL, 0 }
+};
+
+static const metric_family_t
+zone_families[] = {
+	{ "acpi_thermal_temperature_celsius", "Temperature of the thermal zone", offsetof(thermal_t, temperature) },
+	{ "acpi_thermal_mode", "thermal_mode_t of the thermal zone", offsetof(thermal_t, therm_mode) },
+	{ "acpi_thermal_state", "thermal_state_t of the thermal zone", offsetof(thermal_t, therm_state) },
+	{ "acpi_thermal_critical_celsius", "Critical temperature of a hwmon sensor", offsetof(thermal_t, crit) },
+	{ "acpi_thermal_max_celsius", "Maximum temperature of a hwmon sensor", offsetof(thermal_t, max) },
+	{ NULL, NULL, 0 }
+};
+
+static const metric_family_t
+fan_families[] = {
+	{ "acpi_fan_state", "fan_state_t of the fan", offsetof(fan_t, fan_state) },
+	{ "acpi_fan_rpm", "Speed of a hwmon fan", offsetof(fan_t, rpm) },
+	{ NULL, NULL, 0 }
+};
+
+static const metric_family_t
+pcap_families[] = {
+	{ "acpi_powercap_power_milliwatts", "Average power of the powercap zone between the last two reads", offsetof(powercap_t, power) },
+	{ NULL, NULL, 0 }
+};
+
+static metric_line_t lines[METRICS_LINES];
+static int line_count;
+static char text[METRICS_TEXT];
+static size_t text_len;
+
+/* append formatted text to the prefix pool, returns NULL if it is full */
+static char *
+text_add(const char *fmt, const char *a, const char *b, const char *c){
+	char *start = text + text_len;
+	int n = snprintf(start, METRICS_TEXT - text_len, fmt, a, b, c);
+
+	if(n < 0 || (size_t)n >= METRICS_TEXT - text_len)
+		return NULL;
+	text_len += n;
+	return start;
+}
+
+/* copy name into buf escaping characters not allowed in label values */
+static void
+escape_label(char *buf, size_t size, const char *name){
+	size_t i = 0;
+
+	for(; *name && i + 2 < size; name++){
+		if(*name == '"' || *name == '\\')
+			buf[i++] = '\\';
+		buf[i++] = *name;
+	}
+	buf[i] = '\0';
+}
+
+/* add one family with a sample line for each of count devices */
+static int
+add_family(const metric_family_t *f, const char *label, const char *base,
+		size_t stride, const char *(*name)(int), int count){
+	char dev[MAX_NAME];
+	int i;
+
+	if(!count)
+		return SUCCESS;
+	if(line_count == METRICS_LINES)
+		return ITEM_EXCEED;
+	if((lines[line_count].prefix = text_add("# TYPE %s gauge\n# HELP %s %s\n",
+			f->name, f->name, f->help)) == NULL)
+		return BUF_EXCEED;
+	lines[line_count].len = text + text_len - lines[line_count].prefix;
+	lines[line_count].value = NULL;
+	line_count++;
+	for(i = 0; i < count; i++){
+		if(line_count == METRICS_LINES)
+			return ITEM_EXCEED;
+		escape_label(dev, sizeof(dev), name(i));
+		lines[line_count].prefix = text + text_len;
+		if(!text_add("%s{%s=\"%s\"} ", f->name, label, dev))
+			return BUF_EXCEED;
+		lines[line_count].len = text + text_len - lines[line_count].prefix;
+		lines[line_count].value = (const int *)(base + i * stride + f->offset);
+		line_count++;
+	}
+	return SUCCESS;
+}
+
+static const char *
+batt_name(int i){
+	return batteries[i].name;
+}
+
+static const char *
+zone_name(int i){
+	return thermals[i].name;
+}
+
+static const char *
+fan_name(int i){
+	return fans[i].name;
+}
+
+static const char *
+pcap_name(int i){
+	return powercaps[i].name;
+}
+
+/* precompute all metric lines for the devices currently known */
+int
+acpi_metrics_prepare(global_t *globals){
+	static const char ac_header[] = "# TYPE acpi_ac_state gauge\n"
+		"# HELP acpi_ac_state power_state_t of the ac adapter\n";
+	static const char ac_line[] = "acpi_ac_state ";
+	const metric_family_t *f;
+	int ret;
+
+	line_count = 0;
+	text_len = 0;
+
+	lines[line_count].prefix = ac_header;
+	lines[line_count].len = sizeof(ac_header) - 1;
+	lines[line_count].value = NULL;
+	line_count++;
+	lines[line_count].prefix = ac_line;
+	lines[line_count].len = sizeof(ac_line) - 1;
+	lines[line_count].value = (const int *)&globals->adapt.ac_state;
+	line_count++;
+
+	for(f = batt_families; f->name; f++)
+		if((ret = add_family(f, "battery", (const char *)batteries, sizeof(battery_t),
+				batt_name, globals->batt_count)) != SUCCESS)
+			return ret;
+	for(f = zone_families; f->name; f++)
+		if((ret = add_family(f, "zone", (const char *)thermals, sizeof(thermal_t),
+				zone_name, globals->thermal_count)) != SUCCESS)
+			return ret;
+	for(f = fan_families; f->name; f++)
+		if((ret = add_family(f, "fan", (const char *)fans, sizeof(fan_t),
+				fan_name, globals->fan_count)) != SUCCESS)
+			return ret;
+	for(f = pcap_families; f->name; f++)
+		if((ret = add_family(f, "powercap", (const char *)powercaps, sizeof(powercap_t),
+				pcap_name, globals->powercap_count)) != SUCCESS)
+			return ret;
+	return SUCCESS;
+}
+
+/* format v in decimal at buf, returns the number of characters written */
+static size_t
+format_int(char *buf, int v){
+	char tmp[12];
+	unsigned int u = v < 0 ? -(unsigned int)v : (unsigned int)v;
+	size_t n = 0, len = 0;
+
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while(u);
+	if(v < 0) buf[len++] = '-';
+	while(n)
+		buf[len++] = tmp[--n];
+	return len;
+}
+
+static const char eof[] = "# EOF\n";
+
+/* size acpi_metrics_render() needs for the prepared lines whatever their
+ * values are, counted the way it checks the space */
+size_t
+acpi_metrics_size(void){
+	size_t size = sizeof(eof) - 1;
+	int i;
+
+	for(i = 0; i < line_count; i++)
+		size += lines[i].len + 12;
+	return size;
+}
+
+/* write all metric lines with their current values into buf */
+int
+acpi_metrics_render(char *buf, size_t size){
+	size_t pos = 0;
+	int i;
+
+	for(i = 0; i < line_count; i++){
+		if(lines[i].value && *lines[i].value == NOT_SUPPORTED)
+			continue;
+		/* 11 characters for the value and one for the newline */
+		if(pos + lines[i].len + 12 > size)
+			return BUF_EXCEED;
+		memcpy(buf + pos, lines[i].prefix, lines[i].len);
+		pos += lines[i].len;
+		if(!lines[i].value)
+			continue;
+		pos += format_int(buf + pos, *lines[i].value);
+		buf[pos++] = '\n';
+	}
+	if(pos + sizeof(eof) - 1 > size)
+		return BUF_EXCEED;
+	memcpy(buf + pos, eof, sizeof(eof) - 1);
+	return pos + sizeof(eof) - 1;
+}
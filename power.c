@@ -0,0 +1,237 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * High rate power sampling of a battery with energy accounting.
+ *
+ * A thread reads power_now, or current_now and voltage_now, through file
+ * descriptors which stay open for the whole run. Every reading goes into
+ * a single producer single consumer ring and is integrated into an energy
+ * counter in nJ, which only ever grows.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "libacpi.h"
+
+/* nJ per uWh */
+#define NJ_PER_UWH 3600000ULL
+
+static pthread_t thread;
+static int running;
+static int timer_fd = -1, stop_fd = -1;
+static int power_fd = -1, current_fd = -1, voltage_fd = -1;
+
+static acpi_power_sample_t ring[POWER_RING];
+static atomic_size_t head, tail;
+static atomic_ulong dropped;
+static atomic_ullong energy;
+
+/* read a decimal attribute through an open descriptor into v, any value
+ * is valid, returns SUCCESS or NOT_SUPPORTED */
+static int
+read_attr(const int fd, long long *v){
+	char buf[32];
+	ssize_t n;
+
+	if((n = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return NOT_SUPPORTED;
+	buf[n] = '\0';
+	*v = strtoll(buf, NULL, 10);
+	return SUCCESS;
+}
+
+/* power draw in uW with the sign the driver reports it with, returns
+ * SUCCESS or NOT_SUPPORTED */
+static int
+read_power(long long *power){
+	long long cur, volt;
+
+	if(power_fd >= 0)
+		return read_attr(power_fd, power);
+	if(read_attr(current_fd, &cur) != SUCCESS || read_attr(voltage_fd, &volt) != SUCCESS)
+		return NOT_SUPPORTED;
+	/* uA * uV */
+	*power = llabs(cur) * volt / 1000000;
+	return SUCCESS;
+}
+
+static long long
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* push a sample, it is dropped if the reader does not keep up */
+static void
+ring_push(const acpi_power_sample_t *s){
+	size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+
+	if(h - atomic_load_explicit(&tail, memory_order_acquire) == POWER_RING){
+		atomic_fetch_add(&dropped, 1);
+		return;
+	}
+	ring[h % POWER_RING] = *s;
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+}
+
+static void *
+power_main(void *unused){
+	struct pollfd pfd[2];
+	acpi_power_sample_t s, last;
+	uint64_t expired;
+	unsigned long long rest = 0, e;
+
+	(void)unused;
+	pfd[0].fd = stop_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = timer_fd;
+	pfd[1].events = POLLIN;
+	memset(&last, 0, sizeof(last));
+	last.ns = -1;
+	for(;;){
+		if(poll(pfd, 2, -1) < 0)
+			continue;
+		if(pfd[0].revents)
+			break;
+		if(read(timer_fd, &expired, sizeof(expired)) <= 0)
+			continue;
+		s.ns = now_ns();
+		if(read_power(&s.power) != SUCCESS)
+			continue;
+		/* draw while charging is reported positive by some drivers and
+		 * negative by others, the counter counts both as consumption */
+		if(s.power < 0) s.power = -s.power;
+		if(last.ns >= 0){
+			/* trapezoid, uW * ns gives fJ, keep the remainder below 1 nJ */
+			rest += (unsigned long long)(s.power + last.power) / 2 * (s.ns - last.ns);
+			e = atomic_load_explicit(&energy, memory_order_relaxed) + rest / 1000000;
+			rest %= 1000000;
+			atomic_store_explicit(&energy, e, memory_order_release);
+		}
+		s.energy = atomic_load_explicit(&energy, memory_order_relaxed);
+		ring_push(&s);
+		last = s;
+	}
+	return NULL;
+}
+
+/* close all descriptors of the sampling mode */
+static void
+close_fds(void){
+	int *fds[] = { &timer_fd, &stop_fd, &power_fd, &current_fd, &voltage_fd };
+	size_t i;
+
+	for(i = 0; i < sizeof(fds) / sizeof(fds[0]); i++){
+		if(*fds[i] >= 0) close(*fds[i]);
+		*fds[i] = -1;
+	}
+}
+
+/* start sampling battery num every period_us microseconds */
+int
+acpi_power_start(const int num, const int period_us){
+	battery_t *info;
+	struct itimerspec its;
+
+	if(running)
+		return DISABLED;
+	if(num < 0 || num >= MAX_ITEMS)
+		return ITEM_EXCEED;
+	if(period_us <= 0)
+		return NOT_SUPPORTED;
+	info = &batteries[num];
+	/* unused slots have no directory, closed ones no handle */
+	if(!info->dir || info->dir_fd < 0)
+		return ITEM_EXCEED;
+
+	if((power_fd = openat(info->dir_fd, "power_now", O_RDONLY | O_CLOEXEC)) < 0 &&
+			((current_fd = openat(info->dir_fd, "current_now", O_RDONLY | O_CLOEXEC)) < 0 ||
+			(voltage_fd = openat(info->dir_fd, "voltage_now", O_RDONLY | O_CLOEXEC)) < 0)){
+		close_fds();
+		return NOT_SUPPORTED;
+	}
+	if((stop_fd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+			(timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0){
+		close_fds();
+		return NOT_SUPPORTED;
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = period_us / 1000000;
+	its.it_interval.tv_nsec = (period_us % 1000000) * 1000L;
+	its.it_value = its.it_interval;
+	timerfd_settime(timer_fd, 0, &its, NULL);
+
+	atomic_store(&head, 0);
+	atomic_store(&tail, 0);
+	atomic_store(&dropped, 0);
+	if(pthread_create(&thread, NULL, power_main, NULL)){
+		close_fds();
+		return NOT_SUPPORTED;
+	}
+	running = 1;
+	return SUCCESS;
+}
+
+/* stop sampling, the energy counter keeps its value */
+void
+acpi_power_stop(void){
+	if(!running)
+		return;
+	eventfd_write(stop_fd, 1);
+	pthread_join(thread, NULL);
+	close_fds();
+	running = 0;
+}
+
+/* take up to n samples out of the ring */
+size_t
+acpi_power_read(acpi_power_sample_t *samples, const size_t n){
+	size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+	size_t h = atomic_load_explicit(&head, memory_order_acquire);
+	size_t i;
+
+	for(i = 0; i < n && t != h; i++, t++)
+		samples[i] = ring[t % POWER_RING];
+	atomic_store_explicit(&tail, t, memory_order_release);
+	return i;
+}
+
+/* samples lost to a full ring */
+unsigned long
+acpi_power_dropped(void){
+	return atomic_load(&dropped);
+}
+
+/* energy consumed since the library was loaded in uWh */
+unsigned long long
+acpi_power_energy(void){
+	return atomic_load_explicit(&energy, memory_order_acquire) / NJ_PER_UWH;
+}
+
+/* remember the current time and energy */
+void
+acpi_power_mark(acpi_power_mark_t *mark){
+	mark->ns = now_ns();
+	mark->energy = atomic_load_explicit(&energy, memory_order_acquire);
+}
+
+/* energy consumed between two markers in uWh */
+unsigned long long
+acpi_power_between(const acpi_power_mark_t *from, const acpi_power_mark_t *to){
+	if(to->energy < from->energy)
+		return 0;
+	return (to->energy - from->energy) / NJ_PER_UWH;
+}
@@ -0,0 +1,338 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Background sampler: refreshes the devices on timers and reports state
+ * transitions to callbacks.
+ *
+ * The sampler thread waits on one timerfd per device class, refreshes the
+ * class under the sampler lock and walks acpi_changes() for transitions.
+ * Those go into a single producer single consumer ring, the dispatcher
+ * thread is woken by an eventfd and invokes the callbacks outside the lock.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "libacpi.h"
+
+typedef struct {
+	acpi_event_cb cb;
+	void *arg;
+} sampler_cb_t;
+
+static sampler_cb_t callbacks[SAMPLER_CALLBACKS];
+static int callback_count;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t sampler, dispatcher;
+static int running;
+static global_t *globals;
+
+static int timers[ACPI_CLASSES];
+static int stop_fd = -1;     /* wakes the sampler thread to stop */
+static int notify_fd = -1;   /* wakes the dispatcher thread */
+static atomic_int stopping;
+
+/* the ring, head is only written by the sampler, tail by the dispatcher */
+static acpi_event_t queue[SAMPLER_QUEUE];
+static atomic_size_t head, tail;
+static atomic_ulong dropped;
+
+/* last reported value of every tracked field */
+static int ac_last;
+static int charge_last[MAX_ITEMS];
+static int batt_last[MAX_ITEMS];
+static int zone_last[MAX_ITEMS];
+static unsigned long seen;
+
+/* push an event, returns 0 if the ring was full */
+static int
+queue_push(const acpi_event_t *ev){
+	size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+
+	if(h - atomic_load_explicit(&tail, memory_order_acquire) == SAMPLER_QUEUE)
+		return 0;
+	queue[h % SAMPLER_QUEUE] = *ev;
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+	return 1;
+}
+
+/* pop an event into ev, returns 0 if the ring was empty */
+static int
+queue_pop(acpi_event_t *ev){
+	size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+
+	if(t == atomic_load_explicit(&head, memory_order_acquire))
+		return 0;
+	*ev = queue[t % SAMPLER_QUEUE];
+	atomic_store_explicit(&tail, t + 1, memory_order_release);
+	return 1;
+}
+
+/* true if a battery level change crosses the B_LOW or B_CRIT boundary */
+static int
+batt_crossing(const int old, const int cur){
+	return (old >= B_LOW) != (cur >= B_LOW) || (old >= B_CRIT) != (cur >= B_CRIT);
+}
+
+/* compare a changed field with its last reported value, returns a pointer
+ * to the stored value and the current one in cur, NULL if untracked */
+static int *
+tracked_field(const acpi_change_t *c, int *cur){
+	switch(c->dev_class){
+	case ACPI_CLASS_AC:
+		*cur = globals->adapt.ac_state;
+		return &ac_last;
+	case ACPI_CLASS_BATTERY:
+		if(c->field == G_BATT_CHARGE){
+			*cur = batteries[c->num].charge_state;
+			return &charge_last[c->num];
+		}
+		if(c->field == G_BATT_STATE){
+			*cur = batteries[c->num].batt_state;
+			return &batt_last[c->num];
+		}
+		return NULL;
+	case ACPI_CLASS_ZONE:
+		if(c->field == G_ZONE_STATE){
+			*cur = thermals[c->num].therm_state;
+			return &zone_last[c->num];
+		}
+		return NULL;
+	default:
+		return NULL;
+	}
+}
+
+/* queue the transitions since the last walk, called with the lock held.
+ * Returns the number of queued events */
+static int
+collect_events(void){
+	acpi_change_t c;
+	acpi_event_t ev;
+	int *last, cur, n = 0;
+
+	memset(&c, 0, sizeof(c));
+	c.since = seen;
+	while(acpi_changes(globals, &c) == SUCCESS){
+		if((last = tracked_field(&c, &cur)) == NULL || *last == cur)
+			continue;
+		if(c.dev_class == ACPI_CLASS_BATTERY && c.field == G_BATT_STATE &&
+				!batt_crossing(*last, cur)){
+			*last = cur;
+			continue;
+		}
+		ev.dev_class = c.dev_class;
+		ev.num = c.num;
+		ev.field = c.field;
+		ev.old_value = *last;
+		ev.new_value = cur;
+		ev.gen = c.gen;
+		*last = cur;
+		if(queue_push(&ev))
+			n++;
+		else
+			atomic_fetch_add(&dropped, 1);
+	}
+	seen = acpi_generation();
+	return n;
+}
+
+/* refresh all devices of a class, called with the lock held */
+static void
+refresh_class(const int cls){
+	int i;
+
+	switch(cls){
+	case ACPI_CLASS_AC:
+		read_acpi_acstate(globals);
+		break;
+	case ACPI_CLASS_BATTERY:
+		for(i = 0; i < globals->batt_count; i++)
+			read_acpi_batt(i);
+		break;
+	case ACPI_CLASS_ZONE:
+		for(i = 0; i < globals->thermal_count; i++)
+			read_acpi_zone(i, globals);
+		break;
+	case ACPI_CLASS_FAN:
+		for(i = 0; i < globals->fan_count; i++)
+			read_acpi_fan(i);
+		break;
+	case ACPI_CLASS_POWERCAP:
+		for(i = 0; i < globals->powercap_count; i++)
+			read_acpi_powercap(i);
+		break;
+	}
+}
+
+static void *
+sampler_main(void *unused){
+	struct pollfd pfd[ACPI_CLASSES + 1];
+	uint64_t expired;
+	int i, n;
+
+	(void)unused;
+	pfd[0].fd = stop_fd;
+	pfd[0].events = POLLIN;
+	for(i = 0; i < ACPI_CLASSES; i++){
+		pfd[i + 1].fd = timers[i];
+		pfd[i + 1].events = POLLIN;
+	}
+	for(;;){
+		if(poll(pfd, ACPI_CLASSES + 1, -1) < 0)
+			continue;
+		if(pfd[0].revents)
+			break;
+		pthread_mutex_lock(&lock);
+		for(i = 0; i < ACPI_CLASSES; i++)
+			if(pfd[i + 1].revents && read(timers[i], &expired, sizeof(expired)) > 0)
+				refresh_class(i);
+		n = collect_events();
+		pthread_mutex_unlock(&lock);
+		if(n)
+			eventfd_write(notify_fd, 1);
+	}
+	return NULL;
+}
+
+static void *
+dispatcher_main(void *unused){
+	acpi_event_t ev;
+	eventfd_t count;
+	int i;
+
+	(void)unused;
+	for(;;){
+		eventfd_read(notify_fd, &count);
+		while(queue_pop(&ev))
+			for(i = 0; i < callback_count; i++)
+				callbacks[i].cb(&ev, callbacks[i].arg);
+		if(atomic_load(&stopping))
+			break;
+	}
+	return NULL;
+}
+
+/* close all timers and event descriptors */
+static void
+close_fds(void){
+	int i;
+
+	for(i = 0; i < ACPI_CLASSES; i++){
+		if(timers[i] >= 0) close(timers[i]);
+		timers[i] = -1;
+	}
+	if(stop_fd >= 0) close(stop_fd);
+	if(notify_fd >= 0) close(notify_fd);
+	stop_fd = notify_fd = -1;
+}
+
+/* register a callback for transitions */
+int
+acpi_sampler_register(acpi_event_cb cb, void *arg){
+	if(running)
+		return DISABLED;
+	if(callback_count == SAMPLER_CALLBACKS)
+		return ITEM_EXCEED;
+	callbacks[callback_count].cb = cb;
+	callbacks[callback_count].arg = arg;
+	callback_count++;
+	return SUCCESS;
+}
+
+/* start the sampler and dispatcher threads */
+int
+acpi_sampler_start(global_t *g, const int period[ACPI_CLASSES]){
+	struct itimerspec its;
+	int i;
+
+	if(running)
+		return DISABLED;
+	globals = g;
+	for(i = 0; i < ACPI_CLASSES; i++)
+		timers[i] = -1;
+	if((stop_fd = eventfd(0, EFD_CLOEXEC)) < 0 || (notify_fd = eventfd(0, EFD_CLOEXEC)) < 0){
+		close_fds();
+		return NOT_SUPPORTED;
+	}
+	for(i = 0; i < ACPI_CLASSES; i++){
+		if(period[i] <= 0)
+			continue;
+		if((timers[i] = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0){
+			close_fds();
+			return NOT_SUPPORTED;
+		}
+		memset(&its, 0, sizeof(its));
+		its.it_interval.tv_sec = period[i] / 1000;
+		its.it_interval.tv_nsec = (period[i] % 1000) * 1000000L;
+		its.it_value = its.it_interval;
+		timerfd_settime(timers[i], 0, &its, NULL);
+	}
+
+	/* the values present now are the baseline for the first transitions */
+	ac_last = globals->adapt.ac_state;
+	for(i = 0; i < globals->batt_count; i++){
+		charge_last[i] = batteries[i].charge_state;
+		batt_last[i] = batteries[i].batt_state;
+	}
+	for(i = 0; i < globals->thermal_count; i++)
+		zone_last[i] = thermals[i].therm_state;
+	seen = acpi_generation();
+	atomic_store(&head, 0);
+	atomic_store(&tail, 0);
+	atomic_store(&dropped, 0);
+	atomic_store(&stopping, 0);
+
+	if(pthread_create(&dispatcher, NULL, dispatcher_main, NULL)){
+		close_fds();
+		return NOT_SUPPORTED;
+	}
+	if(pthread_create(&sampler, NULL, sampler_main, NULL)){
+		atomic_store(&stopping, 1);
+		eventfd_write(notify_fd, 1);
+		pthread_join(dispatcher, NULL);
+		close_fds();
+		return NOT_SUPPORTED;
+	}
+	running = 1;
+	return SUCCESS;
+}
+
+/* stop both threads, the dispatcher drains the queue first */
+void
+acpi_sampler_stop(void){
+	if(!running)
+		return;
+	eventfd_write(stop_fd, 1);
+	pthread_join(sampler, NULL);
+	atomic_store(&stopping, 1);
+	eventfd_write(notify_fd, 1);
+	pthread_join(dispatcher, NULL);
+	close_fds();
+	callback_count = 0;
+	running = 0;
+}
+
+void
+acpi_sampler_lock(void){
+	pthread_mutex_lock(&lock);
+}
+
+void
+acpi_sampler_unlock(void){
+	pthread_mutex_unlock(&lock);
+}
+
+/* number of events lost to a full queue */
+unsigned long
+acpi_sampler_dropped(void){
+	return atomic_load(&dropped);
+}
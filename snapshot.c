@@ -0,0 +1,265 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Compact binary snapshots of the numeric acpi state
+ */
+
+#include <string.h>
+
+#include "libacpi.h"
+
+static const unsigned char snap_magic[4] = { 'L', 'A', 'C', 'P' };
+
+/* map signed deltas to unsigned so small negative values stay small */
+static unsigned long long
+zigzag(long long v){
+	return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static long long
+unzigzag(unsigned long long v){
+	return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+/* write v as varint at pos, returns new position or 0 if buf is too small */
+static size_t
+put_varint(unsigned char *buf, size_t size, size_t pos, unsigned long long v){
+	do {
+		if(pos >= size) return 0;
+		buf[pos++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+		v >>= 7;
+	} while(v);
+	return pos;
+}
+
+/* read a varint at *pos, returns SUCCESS or BAD_FORMAT */
+static int
+get_varint(const unsigned char *buf, size_t size, size_t *pos, unsigned long long *v){
+	int shift = 0;
+
+	*v = 0;
+	for(; *pos < size && shift < 64; shift += 7){
+		*v |= (unsigned long long)(buf[*pos] & 0x7f) << shift;
+		if(!(buf[(*pos)++] & 0x80))
+			return SUCCESS;
+	}
+	return BAD_FORMAT;
+}
+
+/* collect the current numeric state in record order */
+static int
+snap_collect(global_t *globals, int *v){
+	int i, n = 0;
+	battery_t *b;
+	thermal_t *t;
+
+	v[n++] = globals->adapt.ac_state;
+	for(i = 0; i < globals->batt_count; i++){
+		b = &batteries[i];
+		v[n + SNAP_BATT_PRESENT] = b->present;
+		v[n + SNAP_BATT_REMAINING_CAP] = b->remaining_cap;
+		v[n + SNAP_BATT_LAST_FULL_CAP] = b->last_full_cap;
+		v[n + SNAP_BATT_PRESENT_RATE] = b->present_rate;
+		v[n + SNAP_BATT_PRESENT_VOLTAGE] = b->present_voltage;
+		v[n + SNAP_BATT_PERCENTAGE] = b->percentage;
+		v[n + SNAP_BATT_CHARGE_TIME] = b->charge_time;
+		v[n + SNAP_BATT_REMAINING_TIME] = b->remaining_time;
+		v[n + SNAP_BATT_CHARGE_STATE] = b->charge_state;
+		v[n + SNAP_BATT_STATE] = b->batt_state;
+		v[n + SNAP_BATT_ALARM] = b->alarm;
+		n += SNAP_BATT_VALUES;
+	}
+	for(i = 0; i < globals->thermal_count; i++){
+		t = &thermals[i];
+		v[n + SNAP_ZONE_TEMPERATURE] = t->temperature;
+		v[n + SNAP_ZONE_FREQUENCY] = t->frequency;
+		v[n + SNAP_ZONE_MODE] = t->therm_mode;
+		v[n + SNAP_ZONE_STATE] = t->therm_state;
+		n += SNAP_ZONE_VALUES;
+	}
+	for(i = 0; i < globals->fan_count; i++){
+		v[n + SNAP_FAN_STATE] = fans[i].fan_state;
+		v[n + SNAP_FAN_RPM] = fans[i].rpm;
+		n += SNAP_FAN_VALUES;
+	}
+	for(i = 0; i < globals->powercap_count; i++)
+		v[n++] = powercaps[i].power;
+	return n;
+}
+
+/* number of values per record for the given device counts */
+static int
+snap_count(int batt, int thermal, int fan, int pcap){
+	return SNAP_GLOBAL_VALUES + batt * SNAP_BATT_VALUES +
+		thermal * SNAP_ZONE_VALUES + fan * SNAP_FAN_VALUES + pcap * SNAP_PCAP_VALUES;
+}
+
+/* name of device dev, numbered as in the dictionary */
+static const char *
+snap_dev_name(global_t *globals, int dev){
+	if(dev < globals->batt_count)
+		return batteries[dev].name;
+	if((dev -= globals->batt_count) < globals->thermal_count)
+		return thermals[dev].name;
+	if((dev -= globals->thermal_count) < globals->fan_count)
+		return fans[dev].name;
+	return powercaps[dev - globals->fan_count].name;
+}
+
+/* write the stream header and the device name dictionary */
+int
+acpi_snap_begin(acpi_snap_t *snap, global_t *globals, unsigned char *buf, size_t size){
+	size_t pos = sizeof(snap_magic) + 5;
+	size_t len;
+	const char *name;
+	int i, devs;
+
+	if(globals->batt_count > MAX_ITEMS || globals->thermal_count > MAX_ITEMS ||
+			globals->fan_count > MAX_ITEMS || globals->powercap_count > MAX_ITEMS)
+		return ITEM_EXCEED;
+	if(size < pos) return BUF_EXCEED;
+
+	memset(snap, 0, sizeof(*snap));
+	memcpy(buf, snap_magic, sizeof(snap_magic));
+	buf[4] = SNAP_VERSION;
+	buf[5] = globals->batt_count;
+	buf[6] = globals->thermal_count;
+	buf[7] = globals->fan_count;
+	buf[8] = globals->powercap_count;
+
+	devs = globals->batt_count + globals->thermal_count + globals->fan_count + globals->powercap_count;
+	for(i = 0; i < devs; i++){
+		name = snap_dev_name(globals, i);
+		if((len = strlen(name)) > 255) len = 255;
+		if(pos + 1 + len > size) return BUF_EXCEED;
+		buf[pos++] = len;
+		memcpy(buf + pos, name, len);
+		pos += len;
+	}
+
+	snap->buf = buf;
+	snap->size = size;
+	snap->pos = pos;
+	snap->names = sizeof(snap_magic) + 5;
+	snap->batt_count = globals->batt_count;
+	snap->thermal_count = globals->thermal_count;
+	snap->fan_count = globals->fan_count;
+	snap->powercap_count = globals->powercap_count;
+	snap->count = snap_count(snap->batt_count, snap->thermal_count,
+			snap->fan_count, snap->powercap_count);
+	return SUCCESS;
+}
+
+/* append a record with the values that changed since the last one */
+int
+acpi_snap_append(acpi_snap_t *snap, global_t *globals, long timestamp){
+	int cur[SNAP_MAX_VALUES];
+	size_t map, bytes, pos;
+	int i;
+
+	if(globals->batt_count != snap->batt_count || globals->thermal_count != snap->thermal_count ||
+			globals->fan_count != snap->fan_count || globals->powercap_count != snap->powercap_count)
+		return BAD_FORMAT;
+	snap_collect(globals, cur);
+
+	if(!(pos = put_varint(snap->buf, snap->size, snap->pos,
+			zigzag((long long)timestamp - snap->time))))
+		return BUF_EXCEED;
+	map = pos;
+	bytes = (snap->count + 7) / 8;
+	if(map + bytes > snap->size) return BUF_EXCEED;
+	memset(snap->buf + map, 0, bytes);
+	pos += bytes;
+
+	for(i = 0; i < snap->count; i++){
+		if(cur[i] == snap->values[i])
+			continue;
+		snap->buf[map + i / 8] |= 1 << (i % 8);
+		if(!(pos = put_varint(snap->buf, snap->size, pos,
+				zigzag((long long)cur[i] - snap->values[i]))))
+			return BUF_EXCEED;
+	}
+
+	/* only commit the record once it fitted completely */
+	memcpy(snap->values, cur, snap->count * sizeof(int));
+	snap->time = timestamp;
+	snap->pos = pos;
+	return SUCCESS;
+}
+
+/* check the header of a stream and prepare to decode records */
+int
+acpi_snap_open(acpi_snap_t *snap, const unsigned char *data, size_t size){
+	size_t pos = sizeof(snap_magic) + 5;
+	int i, devs;
+
+	if(size < pos || memcmp(data, snap_magic, sizeof(snap_magic)) || data[4] != SNAP_VERSION)
+		return BAD_FORMAT;
+	if(data[5] > MAX_ITEMS || data[6] > MAX_ITEMS || data[7] > MAX_ITEMS || data[8] > MAX_ITEMS)
+		return BAD_FORMAT;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->batt_count = data[5];
+	snap->thermal_count = data[6];
+	snap->fan_count = data[7];
+	snap->powercap_count = data[8];
+	snap->names = pos;
+	devs = snap->batt_count + snap->thermal_count + snap->fan_count + snap->powercap_count;
+	for(i = 0; i < devs; i++){
+		if(pos >= size || pos + 1 + data[pos] > size)
+			return BAD_FORMAT;
+		pos += 1 + data[pos];
+	}
+
+	snap->data = data;
+	snap->size = size;
+	snap->pos = pos;
+	snap->count = snap_count(snap->batt_count, snap->thermal_count, snap->fan_count,
+			snap->powercap_count);
+	return SUCCESS;
+}
+
+/* decode the next record into snap->time and snap->values */
+int
+acpi_snap_next(acpi_snap_t *snap){
+	unsigned long long v, dt;
+	size_t map, pos = snap->pos;
+	int vals[SNAP_MAX_VALUES];
+	int i;
+
+	if(pos == snap->size) return NOT_PRESENT;
+	if(get_varint(snap->data, snap->size, &pos, &dt) != SUCCESS)
+		return BAD_FORMAT;
+	map = pos;
+	pos += (snap->count + 7) / 8;
+	if(pos > snap->size) return BAD_FORMAT;
+
+	memcpy(vals, snap->values, snap->count * sizeof(int));
+	for(i = 0; i < snap->count; i++){
+		if(!(snap->data[map + i / 8] & (1 << (i % 8))))
+			continue;
+		if(get_varint(snap->data, snap->size, &pos, &v) != SUCCESS)
+			return BAD_FORMAT;
+		vals[i] = (int)(vals[i] + unzigzag(v));
+	}
+	/* only commit the record once it was decoded completely */
+	snap->time += (long)unzigzag(dt);
+	memcpy(snap->values, vals, snap->count * sizeof(int));
+	snap->pos = pos;
+	return SUCCESS;
+}
+
+/* return the dictionary entry for device dev */
+const char *
+acpi_snap_name(const acpi_snap_t *snap, int dev, size_t *len){
+	const unsigned char *base = snap->data ? snap->data : snap->buf;
+	size_t pos = snap->names;
+
+	if(dev < 0 || dev >= snap->batt_count + snap->thermal_count + snap->fan_count +
+			snap->powercap_count)
+		return NULL;
+	while(dev--)
+		pos += 1 + base[pos];
+	*len = base[pos];
+	return (const char *)base + pos + 1;
+}
@@ -0,0 +1,161 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * soak test for libacpi, refreshes all devices for many cycles and fails
+ * if a refresh allocates memory or the resident set keeps growing.
+ * Allocations are counted by wrapping malloc(), calloc(), realloc() and
+ * strdup() at link time, see the Makefile.
+ * The devices come from soak.trace, or the trace given with -r, so the
+ * test runs the same on every machine. With -s they come from the file
+ * system instead, -w records such a run into a new trace. soak.trace was
+ * recorded with -s -n 10 -w from a fixture tree mounted over
+ * /sys/class/power_supply, thermal, hwmon and powercap: two mains
+ * adapters, a USB source, a battery, three thermal zones, hwmon
+ * temperatures and fans and four powercap zones.
+ * usage: soak-libacpi [-n cycles] [-r trace | -s [-w trace]]
+ */
+
+#include "libacpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#define DEFAULT_CYCLES 100000
+#define DEFAULT_TRACE "soak.trace"
+#define WARMUP_CYCLES 1000
+/* growth of the maximum resident set allowed after the warm-up, in kB */
+#define RSS_SLACK 64
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+char *__real_strdup(const char *s);
+
+static unsigned long allocs;
+
+void *
+__wrap_malloc(size_t size){
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size){
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *p, size_t size){
+	allocs++;
+	return __real_realloc(p, size);
+}
+
+char *
+__wrap_strdup(const char *s){
+	allocs++;
+	return __real_strdup(s);
+}
+
+static long
+max_rss(void){
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+/* one refresh of every device */
+static void
+refresh(global_t *global){
+	int i;
+
+	read_acpi_acstate(global);
+	for(i = 0; i < global->batt_count; i++)
+		read_acpi_batt(i);
+	for(i = 0; i < global->thermal_count; i++)
+		read_acpi_zone(i, global);
+	for(i = 0; i < global->fan_count; i++)
+		read_acpi_fan(i);
+	for(i = 0; i < global->powercap_count; i++)
+		read_acpi_powercap(i);
+}
+
+int
+main(int argc, char **argv){
+	global_t global;
+	struct timespec start, end;
+	unsigned long cycles = DEFAULT_CYCLES, n, before;
+	const char *trace = DEFAULT_TRACE, *record = NULL;
+	long rss;
+	double ns;
+	int i, ret = 0;
+
+	for(i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "-n") && i + 1 < argc)
+			cycles = strtoul(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "-r") && i + 1 < argc && trace)
+			trace = argv[++i];
+		else if(!strcmp(argv[i], "-s"))
+			trace = NULL;
+		else if(!strcmp(argv[i], "-w") && i + 1 < argc)
+			record = argv[++i];
+		else
+			break;
+	}
+	if(i < argc || (record && trace)){
+		fprintf(stderr, "usage: %s [-n cycles] [-r trace | -s [-w trace]]\n", argv[0]);
+		return 1;
+	}
+
+	if(trace && acpi_trace_replay(trace, 0) != SUCCESS){
+		fprintf(stderr, "cannot replay %s\n", trace);
+		return 1;
+	}
+	if(record && acpi_trace_record(record) != SUCCESS){
+		fprintf(stderr, "cannot record into %s\n", record);
+		return 1;
+	}
+	memset(&global, 0, sizeof(global));
+	if(acpi_init_all(&global, NULL) != SUCCESS){
+		fprintf(stderr, "no devices found\n");
+		return 1;
+	}
+	printf("devices: %d ac, %d batteries, %d zones, %d fans, %d powercap zones\n",
+			global.adapt_count, global.batt_count, global.thermal_count,
+			global.fan_count, global.powercap_count);
+
+	/* the first refreshes may still settle, e.g. the powercap baselines.
+	 * Short runs, like the one recording a trace, warm up as long */
+	for(n = 0; n < WARMUP_CYCLES && n < cycles; n++)
+		refresh(&global);
+	before = allocs;
+	rss = max_rss();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(n = 0; n < cycles; n++)
+		refresh(&global);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	printf("%lu cycles, %.0f ns per cycle\n", cycles, cycles ? ns / cycles : 0);
+	printf("allocations: %lu\n", allocs - before);
+	printf("max rss: %ld kB after warm-up, %ld kB at the end\n", rss, max_rss());
+	if(allocs != before){
+		printf("FAIL: refreshes allocated memory\n");
+		ret = 1;
+	}
+	if(max_rss() > rss + RSS_SLACK){
+		printf("FAIL: resident set grew\n");
+		ret = 1;
+	}
+	if(!ret)
+		printf("PASS\n");
+
+	close_acpi(&global);
+	if(trace || record)
+		acpi_trace_stop();
+	return ret;
+}
@@ -0,0 +1,204 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * test of the cooling loops of libacpi against a fixture zone. The zone
+ * is built in a temporary directory with two cooling devices, its temp
+ * follows the cur_state writes like a heated box with fans would. Each
+ * policy has to hold the zone near its set point, and stopping has to
+ * restore the states and the zone mode.
+ * usage: test-cooling
+ */
+
+#include "libacpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define STEPS 1000
+/* the box settles at ambient + HEAT without cooling, full cooling takes
+ * away COOLING of that */
+#define HEAT 60.0
+#define COOLING 0.8
+
+static char root[] = "/tmp/libacpi-cool.XXXXXX";
+static double ambient = 30.0;
+static const char *files[] = {
+	"temp", "mode", "cdev0/max_state", "cdev0/cur_state",
+	"cdev1/max_state", "cdev1/cur_state"
+};
+
+static void
+put(const char *name, const char *value){
+	char path[MAX_NAME];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	if((f = fopen(path, "w"))){
+		fputs(value, f);
+		fclose(f);
+	}
+}
+
+static int
+get(const char *name, char *buf, const size_t size){
+	char path[MAX_NAME];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	buf[0] = '\0';
+	if((f = fopen(path, "r"))){
+		if(!fgets(buf, size, f))
+			buf[0] = '\0';
+		fclose(f);
+	}
+	return atoi(buf);
+}
+
+/* a zone at ambient temperature, cdev0 with 10 states at 0, cdev1 with 3 at 1 */
+static void
+build(void){
+	char path[MAX_NAME], buf[32];
+
+	snprintf(path, sizeof(path), "%s/cdev0", root);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/cdev1", root);
+	mkdir(path, 0755);
+	snprintf(buf, sizeof(buf), "%d\n", (int)(ambient * 1000));
+	put("temp", buf);
+	put("mode", "enabled\n");
+	put("cdev0/max_state", "10\n");
+	put("cdev0/cur_state", "0\n");
+	put("cdev1/max_state", "3\n");
+	put("cdev1/cur_state", "1\n");
+}
+
+static void
+destroy(void){
+	char path[MAX_NAME];
+	size_t i;
+
+	for(i = 0; i < sizeof(files) / sizeof(files[0]); i++){
+		snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/cdev0", root);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/cdev1", root);
+	rmdir(path);
+}
+
+/* move the box one step towards the temperature the cooling allows */
+static double
+plant(double temp){
+	char buf[32];
+	double level;
+
+	level = (get("cdev0/cur_state", buf, sizeof(buf)) / 10.0 +
+			get("cdev1/cur_state", buf, sizeof(buf)) / 3.0) / 2;
+	temp += (ambient + HEAT * (1 - COOLING * level) - temp) * 0.05;
+	snprintf(buf, sizeof(buf), "%d\n", (int)(temp * 1000));
+	put("temp", buf);
+	return temp;
+}
+
+/* run a loop on the fixture, returns 0 if it held the zone between lo and hi
+ * and was restored on stop */
+static int
+run(global_t *global, acpi_cool_config_t *cfg, const double lo, const double hi){
+	acpi_cool_status_t status;
+	double temp = ambient;
+	char buf[32];
+	int i, loop, ret = 0;
+
+	build();
+	if((loop = acpi_cool_start(global, cfg)) < 0){
+		printf("\tcannot start the loop: %d\n", loop);
+		destroy();
+		return 1;
+	}
+	get("mode", buf, sizeof(buf));
+	if(strcmp(buf, "disabled")){
+		printf("\tzone mode not taken over\n");
+		ret = 1;
+	}
+	for(i = 0; i < STEPS; i++){
+		temp = plant(temp);
+		acpi_cool_step(global);
+		usleep(2000);
+	}
+	acpi_cool_status(loop, &status);
+	printf("\ttemperature %.1f, level %d, states %d %d, %lu writes\n",
+			temp, status.level, status.state[0], status.state[1], status.writes);
+	if(temp < lo || temp > hi){
+		printf("\ttemperature not within %.0f to %.0f\n", lo, hi);
+		ret = 1;
+	}
+
+	acpi_cool_stop();
+	if(get("cdev0/cur_state", buf, sizeof(buf)) != 0 || get("cdev1/cur_state", buf, sizeof(buf)) != 1){
+		printf("\tcooling states not restored\n");
+		ret = 1;
+	}
+	get("mode", buf, sizeof(buf));
+	if(strcmp(buf, "enabled")){
+		printf("\tzone mode not restored\n");
+		ret = 1;
+	}
+	destroy();
+	return ret;
+}
+
+int
+main(void){
+	global_t global;
+	acpi_cool_config_t cfg;
+	int ret = 0;
+
+	if(!mkdtemp(root)){
+		perror("mkdtemp");
+		return 1;
+	}
+	memset(&global, 0, sizeof(global));
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.zone_dir = root;
+	cfg.take_over = 1;
+	cfg.policy = COOL_CURVE;
+	cfg.curve_points = 2;
+	cfg.curve_temp[0] = 40;
+	cfg.curve_level[0] = 0;
+	cfg.curve_temp[1] = 80;
+	cfg.curve_level[1] = 1000;
+	printf("curve 40 to 80 degrees:\n");
+	ret |= run(&global, &cfg, 58, 68);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.zone_dir = root;
+	cfg.take_over = 1;
+	cfg.policy = COOL_PID;
+	cfg.target = 60;
+	cfg.kp = 100;
+	cfg.ki = 100;
+	printf("pid around 60 degrees:\n");
+	ret |= run(&global, &cfg, 55, 65);
+
+	/* a zone in the cold, temperatures below zero are no read errors */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.zone_dir = root;
+	cfg.take_over = 1;
+	cfg.policy = COOL_CURVE;
+	cfg.curve_points = 2;
+	cfg.curve_temp[0] = -40;
+	cfg.curve_level[0] = 0;
+	cfg.curve_temp[1] = -10;
+	cfg.curve_level[1] = 1000;
+	ambient = -60;
+	printf("curve -40 to -10 degrees:\n");
+	ret |= run(&global, &cfg, -30, -20);
+
+	rmdir(root);
+	printf(ret ? "FAIL\n" : "PASS\n");
+	return ret;
+}
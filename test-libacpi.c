@@ -9,11 +9,12 @@
 #include "libacpi.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 int
 main(void){
-	int i=0;
-	int acstate, battstate, thermstate, fanstate;
+	int i=0, n;
+	int acstate, battstate, thermstate, fanstate, pcapstate;
 
 	/* the global structure is _the_ acpi structure here */
 	global_t *global = malloc (sizeof (global_t));
@@ -21,17 +22,31 @@ main(void){
 	adapter_t *ac = &global->adapt;
 	thermal_t *tp;
 	fan_t *fa;
+	powercap_t *pc;
+	acpi_cpu_headroom_t cpus[8];
+	acpi_init_result_t init[ACPI_CLASSES];
+	acpi_attr_value_t attr;
+	int cycles;
 
 	if(check_acpi_support() == NOT_SUPPORTED){
 		printf("No acpi support for your system?\n");
 		return -1;
 	}
 
-	/* initialize battery, thermal zones, fans and ac state */
-	battstate = init_acpi_batt(global);
-	thermstate = init_acpi_thermal(global);
-	fanstate = init_acpi_fan(global);
-	acstate = init_acpi_acadapt(global);
+	/* attributes beyond the ones in battery_t have to be registered first */
+	cycles = acpi_attr_register(ACPI_CLASS_BATTERY, "cycle_count", ATTR_INT, ATTR_DYNAMIC, NULL);
+
+	/* initialize all device classes at once */
+	acpi_init_all(global, init);
+	acstate = init[ACPI_CLASS_AC].status;
+	battstate = init[ACPI_CLASS_BATTERY].status;
+	thermstate = init[ACPI_CLASS_ZONE].status;
+	fanstate = init[ACPI_CLASS_FAN].status;
+	pcapstate = init[ACPI_CLASS_POWERCAP].status;
+	printf("Init time: ac %lld us, batteries %lld us, zones %lld us, fans %lld us, powercap %lld us\n\n",
+			init[ACPI_CLASS_AC].ns / 1000, init[ACPI_CLASS_BATTERY].ns / 1000,
+			init[ACPI_CLASS_ZONE].ns / 1000, init[ACPI_CLASS_FAN].ns / 1000,
+			init[ACPI_CLASS_POWERCAP].ns / 1000);
 
 	if(acstate == SUCCESS && ac->ac_state == P_BATT)
 		printf("AC adapter: off-line\n");
@@ -66,6 +81,8 @@ main(void){
 						binfo->batt_state, binfo->percentage, 
 						binfo->charge_time / 60, binfo->charge_time % 60,
 						binfo->remaining_time / 60, binfo->remaining_time % 60);
+				if(acpi_attr_get(ACPI_CLASS_BATTERY, i, cycles, &attr) == SUCCESS)
+					printf("\tcycle count: %d\n", attr.value);
 				if(binfo->alarm)
 					printf("%s: Alarm!\n", binfo->name);
 			}
@@ -92,6 +109,13 @@ main(void){
 		}
 		if(global->thermal_count == 1)
 			printf("Temperature: %d C\n", global->temperature);
+		/* CPUs with the most thermal headroom first */
+		if((n = acpi_coolest_cpus(global, cpus, 8)) > 0){
+			printf("\nCoolest CPUs:");
+			for(i=0; i<n; i++)
+				printf(" %d (%d C)", cpus[i].cpu, cpus[i].headroom);
+			printf("\n");
+		}
 	} else printf("Thermal information not supported\n");
 
 	if(fanstate == SUCCESS){
@@ -99,10 +123,28 @@ main(void){
 			/* read fan state */
 			read_acpi_fan(i);
 			fa = &fans[i];
-			printf("\n%s:\tstate: %d\n", fa->name, fa->fan_state);
+			if(fa->rpm != NOT_SUPPORTED)
+				printf("\n%s:\tstate: %d\n"
+					"\tspeed: %d rpm\n",
+					fa->name, fa->fan_state, fa->rpm);
+			else printf("\n%s:\tstate: %d\n", fa->name, fa->fan_state);
 		}
 	} else printf("Fan information:\tnot supported\n");
 
+	if(pcapstate == SUCCESS){
+		/* the power is averaged between two reads, so wait a moment */
+		sleep(1);
+		for(i=0; i<global->powercap_count; i++){
+			read_acpi_powercap(i);
+			pc = &powercaps[i];
+			printf("\n%s:\tname: %s%s\n"
+					"\tenergy: %llu uJ\n"
+					"\tpower: %d mW\n",
+					pc->name, pc->label, pc->parent >= 0 ? " (subzone)" : "",
+					pc->energy, pc->power);
+		}
+	} else printf("Powercap information:\tnot supported\n");
+
 	free(global);
 
 	return 0;
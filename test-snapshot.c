@@ -0,0 +1,195 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * round trip test of the snapshot streams. Made up devices are encoded
+ * with acpi_snap_append() while their values rise and fall, the stream
+ * is decoded with acpi_snap_next() and every record has to come back as
+ * it was written. A record which does not fit the buffer has to leave
+ * the stream as it was.
+ * usage: test-snapshot
+ */
+
+#include "libacpi.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RECORDS 50
+#define STREAM_SIZE 16384
+
+static global_t global;
+static int written[RECORDS][SNAP_MAX_VALUES];
+static long stamps[RECORDS];
+
+/* two batteries, a zone, two fans and a powercap zone */
+static void
+setup(void){
+	memset(&global, 0, sizeof(global));
+	global.batt_count = 2;
+	global.thermal_count = 1;
+	global.fan_count = 2;
+	global.powercap_count = 1;
+	batteries[0].name = "BAT0";
+	batteries[1].name = "BAT1";
+	thermals[0].name = "thermal_zone0";
+	fans[0].name = "hwmon1/fan1";
+	fans[1].name = "hwmon1/fan2";
+	powercaps[0].name = "package-0";
+}
+
+/* values of record r, most of them go down again later and some jump by
+ * more than a byte worth of varint either way */
+static void
+change(const int r){
+	int i;
+
+	global.adapt.ac_state = r % 7 < 3 ? P_AC : P_BATT;
+	for(i = 0; i < global.batt_count; i++){
+		batteries[i].present = 1;
+		batteries[i].remaining_cap = 40000 - r * 300 + i;
+		batteries[i].last_full_cap = 45000;
+		batteries[i].present_rate = r % 2 ? -1500 - r : 2000 + r * 10;
+		batteries[i].present_voltage = 12000 - r % 5 * 100;
+		batteries[i].percentage = batteries[i].remaining_cap * 100 / 45000;
+		batteries[i].charge_time = r % 3 ? NOT_SUPPORTED : 90 - r;
+		batteries[i].remaining_time = 600 - r * 7;
+		batteries[i].charge_state = r % 2 ? C_DISCHARGE : C_CHARGE;
+		batteries[i].batt_state = B_MED;
+		batteries[i].alarm = 0;
+	}
+	thermals[0].temperature = 50 + (r % 10) - 5;
+	thermals[0].frequency = DISABLED;
+	thermals[0].therm_mode = CO_ERR;
+	thermals[0].therm_state = r % 10 > 7 ? T_HOT : T_OK;
+	fans[0].fan_state = r % 4 ? F_ON : F_OFF;
+	fans[0].rpm = r % 4 ? 1000 + r * 37 : 0;
+	fans[1].fan_state = F_ERR;
+	fans[1].rpm = NOT_SUPPORTED;
+	powercaps[0].power = r % 2 ? 15000 + r * 1000 : -(r * 100000);
+}
+
+/* the snapshot values as they should come back */
+static void
+expect(int *v){
+	int i, n = 0;
+
+	v[n++] = global.adapt.ac_state;
+	for(i = 0; i < global.batt_count; i++, n += SNAP_BATT_VALUES){
+		v[n + SNAP_BATT_PRESENT] = batteries[i].present;
+		v[n + SNAP_BATT_REMAINING_CAP] = batteries[i].remaining_cap;
+		v[n + SNAP_BATT_LAST_FULL_CAP] = batteries[i].last_full_cap;
+		v[n + SNAP_BATT_PRESENT_RATE] = batteries[i].present_rate;
+		v[n + SNAP_BATT_PRESENT_VOLTAGE] = batteries[i].present_voltage;
+		v[n + SNAP_BATT_PERCENTAGE] = batteries[i].percentage;
+		v[n + SNAP_BATT_CHARGE_TIME] = batteries[i].charge_time;
+		v[n + SNAP_BATT_REMAINING_TIME] = batteries[i].remaining_time;
+		v[n + SNAP_BATT_CHARGE_STATE] = batteries[i].charge_state;
+		v[n + SNAP_BATT_STATE] = batteries[i].batt_state;
+		v[n + SNAP_BATT_ALARM] = batteries[i].alarm;
+	}
+	for(i = 0; i < global.thermal_count; i++, n += SNAP_ZONE_VALUES){
+		v[n + SNAP_ZONE_TEMPERATURE] = thermals[i].temperature;
+		v[n + SNAP_ZONE_FREQUENCY] = thermals[i].frequency;
+		v[n + SNAP_ZONE_MODE] = thermals[i].therm_mode;
+		v[n + SNAP_ZONE_STATE] = thermals[i].therm_state;
+	}
+	for(i = 0; i < global.fan_count; i++, n += SNAP_FAN_VALUES){
+		v[n + SNAP_FAN_STATE] = fans[i].fan_state;
+		v[n + SNAP_FAN_RPM] = fans[i].rpm;
+	}
+	for(i = 0; i < global.powercap_count; i++, n += SNAP_PCAP_VALUES)
+		v[n + SNAP_PCAP_POWER] = powercaps[i].power;
+}
+
+/* decode stream and compare it with the first records written, returns 0
+ * if all of them and nothing else came back */
+static int
+decode(const unsigned char *stream, const size_t size, const int records){
+	acpi_snap_t snap;
+	const char *name;
+	size_t len;
+	int r, ret;
+
+	if((ret = acpi_snap_open(&snap, stream, size)) != SUCCESS){
+		printf("\tcannot open the stream: %d\n", ret);
+		return 1;
+	}
+	if(!(name = acpi_snap_name(&snap, 3, &len)) || len != strlen(fans[0].name) ||
+			memcmp(name, fans[0].name, len)){
+		printf("\tdevice 3 is not %s\n", fans[0].name);
+		return 1;
+	}
+	for(r = 0; r < records; r++){
+		if((ret = acpi_snap_next(&snap)) != SUCCESS){
+			printf("\trecord %d: cannot decode: %d\n", r, ret);
+			return 1;
+		}
+		if(snap.time != stamps[r] || memcmp(snap.values, written[r], snap.count * sizeof(int))){
+			printf("\trecord %d differs\n", r);
+			return 1;
+		}
+	}
+	if((ret = acpi_snap_next(&snap)) != NOT_PRESENT){
+		printf("\tno end after %d records: %d\n", records, ret);
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(void){
+	static unsigned char stream[STREAM_SIZE];
+	acpi_snap_t snap;
+	size_t size, pos;
+	int r, ret = 0;
+
+	setup();
+
+	printf("round trip of %d records:\n", RECORDS);
+	if(acpi_snap_begin(&snap, &global, stream, sizeof(stream)) != SUCCESS){
+		printf("\tcannot begin the stream\nFAIL\n");
+		return 1;
+	}
+	for(r = 0; r < RECORDS; r++){
+		change(r);
+		expect(written[r]);
+		/* time goes back now and then, e.g. after a clock step */
+		stamps[r] = r % 9 == 8 ? stamps[r - 1] - 5 : r * 1000L;
+		if(acpi_snap_append(&snap, &global, stamps[r]) != SUCCESS){
+			printf("\trecord %d does not fit\nFAIL\n", r);
+			return 1;
+		}
+	}
+	printf("\t%lu bytes\n", (unsigned long)snap.pos);
+	ret |= decode(stream, snap.pos, RECORDS);
+
+	printf("record which does not fit:\n");
+	acpi_snap_begin(&snap, &global, stream, sizeof(stream));
+	change(0);
+	acpi_snap_append(&snap, &global, stamps[0]);
+	/* room for the second record but not the third, which changes more */
+	change(1);
+	acpi_snap_append(&snap, &global, stamps[1]);
+	size = snap.pos + 2;
+	snap.size = size;
+	change(2);
+	pos = snap.pos;
+	if(acpi_snap_append(&snap, &global, stamps[2]) != BUF_EXCEED){
+		printf("\tthird record fitted into 2 bytes\n");
+		ret = 1;
+	} else if(snap.pos != pos){
+		printf("\tfailed record moved the stream from %lu to %lu\n",
+				(unsigned long)pos, (unsigned long)snap.pos);
+		ret = 1;
+	}
+	ret |= decode(stream, snap.pos, 2);
+	/* the encoder has to continue from the last record it kept */
+	snap.size = sizeof(stream);
+	if(acpi_snap_append(&snap, &global, stamps[2]) != SUCCESS){
+		printf("\tthird record does not fit after growing the buffer\n");
+		ret = 1;
+	}
+	ret |= decode(stream, snap.pos, 3);
+
+	printf(ret ? "FAIL\n" : "PASS\n");
+	return ret;
+}
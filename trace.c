@@ -0,0 +1,319 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ * Recording and replay of raw attribute reads and directory listings.
+ *
+ * A trace starts with the magic "LACT" and a version byte, followed by
+ * records of the form: type ('R' read, 'D' directory listing), varint
+ * path length, path, varint latency in ns, zigzag varint data length
+ * (-1 if the file or directory could not be opened) and the data. For
+ * listings the data are the NUL terminated entry names.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libacpi.h"
+#include "list.h"
+#include "trace.h"
+
+#define TRACE_VERSION 1
+
+typedef struct {
+	char type;
+	const char *path;
+	size_t path_len;
+	long long ns;
+	int len;
+	const char *data;
+	int next;          /* next record for the same path, -1 if none */
+} trace_rec_t;
+
+typedef struct {
+	char type;
+	const char *path;
+	size_t path_len;
+	int first;         /* first record for the path */
+	int cursor;        /* record to answer the next request with */
+} trace_key_t;
+
+static const char trace_magic[4] = { 'L', 'A', 'C', 'T' };
+
+int trace_mode = TRACE_OFF;
+
+static FILE *out;
+/* keeps the records and replay cursors of reads on different threads apart */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char *data;
+static trace_rec_t *recs;
+static trace_key_t *keys;
+static size_t key_mask;
+static int timing;
+
+long long
+trace_now(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+put_varint(unsigned long long v){
+	do {
+		fputc((v & 0x7f) | (v > 0x7f ? 0x80 : 0), out);
+		v >>= 7;
+	} while(v);
+}
+
+/* read a varint, returns SUCCESS or BAD_FORMAT */
+static int
+get_varint(const char *buf, size_t size, size_t *pos, unsigned long long *v){
+	int shift = 0;
+
+	*v = 0;
+	for(; *pos < size && shift < 64; shift += 7){
+		*v |= (unsigned long long)(buf[*pos] & 0x7f) << shift;
+		if(!(buf[(*pos)++] & 0x80))
+			return SUCCESS;
+	}
+	return BAD_FORMAT;
+}
+
+/* write a record up to its data, called with the lock held */
+static void
+log_head(char type, const char *path, int len, long long ns){
+	size_t path_len = strlen(path);
+
+	fputc(type, out);
+	put_varint(path_len);
+	fwrite(path, 1, path_len, out);
+	put_varint(ns < 0 ? 0 : ns);
+	/* zigzag, so a failed open (-1) stays one byte */
+	put_varint(((unsigned long long)(long long)len << 1) ^ (unsigned long long)((long long)len >> 63));
+}
+
+static void
+log_record(char type, const char *path, const char *buf, int len, long long ns){
+	pthread_mutex_lock(&lock);
+	log_head(type, path, len, ns);
+	if(len > 0)
+		fwrite(buf, 1, len, out);
+	pthread_mutex_unlock(&lock);
+}
+
+void
+trace_log_read(const char *path, const char *buf, int len, long long ns){
+	log_record('R', path, buf, len, ns);
+}
+
+/* the names are written straight from the list, a listing of any size
+ * is recorded completely */
+void
+trace_log_dir(const char *dir, list_t *lst, long long ns){
+	node_t *node;
+	int len = 0;
+
+	if(!lst){
+		log_record('D', dir, NULL, -1, ns);
+		return;
+	}
+	for(node = lst->top; node; node = node->next)
+		len += strlen(node->name) + 1;
+	pthread_mutex_lock(&lock);
+	log_head('D', dir, len, ns);
+	for(node = lst->top; node; node = node->next)
+		fwrite(node->name, 1, strlen(node->name) + 1, out);
+	pthread_mutex_unlock(&lock);
+}
+
+static size_t
+key_hash(char type, const char *path, size_t len){
+	size_t h = 2166136261u ^ (unsigned char)type;
+
+	while(len--)
+		h = (h ^ (unsigned char)*path++) * 16777619u;
+	return h;
+}
+
+/* find the key slot for a path, an empty slot if it is unknown */
+static trace_key_t *
+key_find(char type, const char *path, size_t len){
+	size_t i = key_hash(type, path, len) & key_mask;
+
+	for(; keys[i].path; i = (i + 1) & key_mask)
+		if(keys[i].type == type && keys[i].path_len == len && !memcmp(keys[i].path, path, len))
+			break;
+	return &keys[i];
+}
+
+/* pick the record answering the next request for path and advance the cursor.
+ * Once all records of a path were used the replay starts over with the first */
+static trace_rec_t *
+next_record(char type, const char *path){
+	trace_key_t *k;
+	trace_rec_t *r;
+	struct timespec ts;
+
+	if(!keys) return NULL;
+	k = key_find(type, path, strlen(path));
+	if(!k->path) return NULL;
+	pthread_mutex_lock(&lock);
+	r = &recs[k->cursor];
+	k->cursor = r->next >= 0 ? r->next : k->first;
+	pthread_mutex_unlock(&lock);
+
+	if(timing && r->ns > 0){
+		ts.tv_sec = r->ns / 1000000000LL;
+		ts.tv_nsec = r->ns % 1000000000LL;
+		nanosleep(&ts, NULL);
+	}
+	return r;
+}
+
+int
+trace_read(const char *path, char *buf, size_t size){
+	trace_rec_t *r = next_record('R', path);
+
+	if(!r || r->len < 0)
+		return -1;
+	memcpy(buf, r->data, (size_t)r->len < size ? (size_t)r->len : size);
+	return (size_t)r->len < size ? (size_t)r->len : size;
+}
+
+list_t *
+trace_dir_list(const char *dir){
+	trace_rec_t *r = next_record('D', dir);
+	list_t *lst;
+	int pos;
+
+	if(!r || r->len < 0 || (lst = new_list()) == NULL)
+		return NULL;
+	for(pos = 0; pos < r->len; pos += strlen(r->data + pos) + 1)
+		append_node(lst, (char *)r->data + pos);
+	return lst;
+}
+
+/* free everything belonging to the current trace */
+void
+acpi_trace_stop(void){
+	if(out) fclose(out);
+	free(data);
+	free(recs);
+	free(keys);
+	out = NULL;
+	data = NULL;
+	recs = NULL;
+	keys = NULL;
+	trace_mode = TRACE_OFF;
+}
+
+/* start logging all reads into file */
+int
+acpi_trace_record(const char *file){
+	acpi_trace_stop();
+	if((out = fopen(file, "wb")) == NULL)
+		return NOT_SUPPORTED;
+	fwrite(trace_magic, 1, sizeof(trace_magic), out);
+	fputc(TRACE_VERSION, out);
+	trace_mode = TRACE_RECORD;
+	return SUCCESS;
+}
+
+/* parse the records of a loaded trace and index them by path */
+static int
+trace_index(size_t size){
+	unsigned long long v;
+	size_t pos = sizeof(trace_magic) + 1, n = 0, cap = 64, i;
+	trace_rec_t *r;
+	trace_key_t *k;
+
+	if(size < pos || memcmp(data, trace_magic, sizeof(trace_magic)) || data[4] != TRACE_VERSION)
+		return BAD_FORMAT;
+	if((recs = malloc(cap * sizeof(*recs))) == NULL)
+		return ALLOC_ERR;
+
+	while(pos < size){
+		if(n == cap){
+			if((r = realloc(recs, (cap *= 2) * sizeof(*recs))) == NULL)
+				return ALLOC_ERR;
+			recs = r;
+		}
+		r = &recs[n];
+		r->type = data[pos++];
+		if(get_varint(data, size, &pos, &v) != SUCCESS || v > size - pos)
+			return BAD_FORMAT;
+		r->path = data + pos;
+		r->path_len = v;
+		pos += v;
+		if(get_varint(data, size, &pos, &v) != SUCCESS)
+			return BAD_FORMAT;
+		r->ns = v;
+		if(get_varint(data, size, &pos, &v) != SUCCESS)
+			return BAD_FORMAT;
+		r->len = (int)((long long)(v >> 1) ^ -(long long)(v & 1));
+		if(r->len > 0 && (size_t)r->len > size - pos)
+			return BAD_FORMAT;
+		/* the names of a listing are NUL terminated, the last one too */
+		if(r->type == 'D' && r->len > 0 && data[pos + r->len - 1] != '\0')
+			return BAD_FORMAT;
+		r->data = data + pos;
+		r->next = -1;
+		if(r->len > 0) pos += r->len;
+		n++;
+	}
+
+	for(key_mask = 16; key_mask < 2 * n; key_mask <<= 1);
+	if((keys = calloc(key_mask, sizeof(*keys))) == NULL)
+		return ALLOC_ERR;
+	key_mask--;
+	/* walk backwards so every record links to the next one of its path */
+	for(i = n; i-- > 0;){
+		r = &recs[i];
+		k = key_find(r->type, r->path, r->path_len);
+		if(k->path)
+			r->next = k->first;
+		k->type = r->type;
+		k->path = r->path;
+		k->path_len = r->path_len;
+		k->first = k->cursor = i;
+	}
+	return SUCCESS;
+}
+
+/* load a trace and answer all reads from it */
+int
+acpi_trace_replay(const char *file, const int with_timing){
+	FILE *in;
+	long size;
+	int ret;
+
+	acpi_trace_stop();
+	if((in = fopen(file, "rb")) == NULL)
+		return NOT_SUPPORTED;
+	if(fseek(in, 0, SEEK_END) || (size = ftell(in)) < 0 || fseek(in, 0, SEEK_SET)){
+		fclose(in);
+		return NOT_SUPPORTED;
+	}
+	/* one extra byte keeps the last string of a listing terminated */
+	if((data = calloc(1, size + 1)) == NULL){
+		fclose(in);
+		return ALLOC_ERR;
+	}
+	if(fread(data, 1, size, in) != (size_t)size){
+		fclose(in);
+		acpi_trace_stop();
+		return NOT_SUPPORTED;
+	}
+	fclose(in);
+	if((ret = trace_index(size)) != SUCCESS){
+		acpi_trace_stop();
+		return ret;
+	}
+	timing = with_timing;
+	trace_mode = TRACE_REPLAY;
+	return SUCCESS;
+}
@@ -0,0 +1,64 @@
+/*
+ * (C)opyright 2007 Nico Golde <nico@ngolde.de>
+ * See LICENSE file for license details
+ */
+
+/**
+ * \file trace.h
+ * \brief recording and replay of raw attribute reads, internal interface
+ */
+
+/**
+ * \enum trace modes
+ * \brief current mode of the trace backend
+ */
+enum {
+	TRACE_OFF,      /**< reads go to the file system */
+	TRACE_RECORD,   /**< reads go to the file system and are logged */
+	TRACE_REPLAY    /**< reads are answered from a loaded trace */
+};
+
+/**
+ * Current trace mode, TRACE_OFF unless acpi_trace_record() or
+ * acpi_trace_replay() was called
+ */
+extern int trace_mode;
+
+/**
+ * Monotonic clock in nanoseconds, used to measure read latency
+ * @return current time
+ */
+long long trace_now(void);
+
+/**
+ * Logs a read of path
+ * @param path file that was read
+ * @param buf bytes returned
+ * @param len number of bytes, negative if the file could not be opened
+ * @param ns time the read took
+ */
+void trace_log_read(const char *path, const char *buf, int len, long long ns);
+
+/**
+ * Answers a read of path from the loaded trace
+ * @param path file to read
+ * @param buf buffer to fill
+ * @param size size of buf
+ * @return number of bytes, negative if the read failed when it was recorded
+ */
+int trace_read(const char *path, char *buf, size_t size);
+
+/**
+ * Logs a directory listing
+ * @param dir directory that was listed
+ * @param lst resulting list, NULL if the directory could not be opened
+ * @param ns time the listing took
+ */
+void trace_log_dir(const char *dir, list_t *lst, long long ns);
+
+/**
+ * Answers a directory listing from the loaded trace
+ * @param dir directory to list
+ * @return linked list or NULL
+ */
+list_t *trace_dir_list(const char *dir);